@@ -49,6 +49,9 @@
 #ifdef EXTRA
     #include "extra.h"
 #endif
+#ifdef STENO
+    #include "steno.h"
+#endif
 
 
 /** HID class report descriptor. This is a special descriptor constructed with values from the
@@ -133,6 +136,37 @@ const USB_Descriptor_HIDReport_Datatype_t PROGMEM KeyboardReport[] = {
     HID_DESCRIPTOR_KEYBOARD(6)
 };
 
+#ifdef NKRO
+/**
+ * Report protocol keyboard without rollover limit: 8 modifier bits followed by a
+ * bitmap of all regular key usages. The boot keyboard interface above is kept for
+ * hosts that select the boot protocol, e.g. BIOS setup.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM NKROReport[] = {
+    HID_DESCRIPTOR_NKRO(NKRO_KEYS_BYTES)
+};
+#endif
+
+#ifdef STENO
+/**
+ * Vendor defined byte stream carrying one GeminiPR packet per report, see steno.h.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM StenoReport[] = {
+    // *INDENT-OFF*
+    HID_RI_USAGE_PAGE(16, 0xFF53),          // Vendor defined
+    HID_RI_USAGE(8, 0x01),
+    HID_RI_COLLECTION(8, 0x01),             // Application
+        HID_RI_LOGICAL_MINIMUM(8, 0x00),
+        HID_RI_LOGICAL_MAXIMUM(16, 0x00FF),
+        HID_RI_REPORT_SIZE(8, 0x08),
+        HID_RI_REPORT_COUNT(8, STENO_PACKET_SIZE),
+        HID_RI_USAGE(8, 0x02),
+        HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+    HID_RI_END_COLLECTION(0),
+    // *INDENT-ON*
+};
+#endif
+
 #ifdef DEBUG_OUTPUT
 const USB_Descriptor_HIDReport_Datatype_t DBGReport[] PROGMEM = {
     0x06, 0x31, 0xFF,    // Usage Page 0xFF31 (vendor defined)
@@ -218,7 +252,7 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor = {
         .Header                 = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
 
         .TotalConfigurationSize = sizeof(USB_Descriptor_Configuration_t),
-        .TotalInterfaces        = 4,  // keyboard, debug, mouse,extra
+        .TotalInterfaces        = INTERFACE_COUNT,  // keyboard, debug, mouse, extra[, nkro][, steno]
 
         .ConfigurationNumber    = 1,
         .ConfigurationStrIndex  = NO_DESCRIPTOR,
@@ -381,6 +415,84 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor = {
             .PollingIntervalMS      = 0x0A
         },
 #endif
+
+#ifdef NKRO
+    .HID_NKROInterface =
+    {
+        .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+        .InterfaceNumber        = INTERFACE_ID_NKRO,
+        .AlternateSetting       = 0x00,
+
+        .TotalEndpoints         = 1,
+
+        .Class                  = HID_CSCP_HIDClass,
+        .SubClass               = HID_CSCP_NonBootSubclass,
+        .Protocol               = HID_CSCP_NonBootProtocol,
+
+        .InterfaceStrIndex      = NO_DESCRIPTOR
+    },
+
+    .HID_NKROHID =
+    {
+        .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID},
+
+        .HIDSpec                = VERSION_BCD(1,1,1),
+        .CountryCode            = 0x00,
+        .TotalReportDescriptors = 1,
+        .HIDReportType          = HID_DTYPE_Report,
+        .HIDReportLength        = sizeof(NKROReport)
+    },
+
+    .HID_NKROReportINEndpoint =
+    {
+        .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+        .EndpointAddress        = NKRO_IN_EPADDR,
+        .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+        .EndpointSize           = NKRO_EPSIZE,
+        .PollingIntervalMS      = 0x01
+    },
+#endif
+
+#ifdef STENO
+    .HID_StenoInterface =
+    {
+        .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+        .InterfaceNumber        = INTERFACE_ID_Steno,
+        .AlternateSetting       = 0x00,
+
+        .TotalEndpoints         = 1,
+
+        .Class                  = HID_CSCP_HIDClass,
+        .SubClass               = HID_CSCP_NonBootSubclass,
+        .Protocol               = HID_CSCP_NonBootProtocol,
+
+        .InterfaceStrIndex      = NO_DESCRIPTOR
+    },
+
+    .HID_StenoHID =
+    {
+        .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID},
+
+        .HIDSpec                = VERSION_BCD(1,1,1),
+        .CountryCode            = 0x00,
+        .TotalReportDescriptors = 1,
+        .HIDReportType          = HID_DTYPE_Report,
+        .HIDReportLength        = sizeof(StenoReport)
+    },
+
+    .HID_StenoReportINEndpoint =
+    {
+        .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+        .EndpointAddress        = STENO_IN_EPADDR,
+        .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+        .EndpointSize           = STENO_EPSIZE,
+        .PollingIntervalMS      = 0x01
+    },
+#endif
 };
 
 /** Language descriptor structure. This descriptor, located in FLASH memory, is returned when the host requests
@@ -458,6 +570,18 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue, const uint16_t wIndex
                     Address = &ConfigurationDescriptor.HID_ExtraHID;
                     Size    = sizeof(USB_HID_Descriptor_HID_t);
                     break;
+#endif
+#ifdef NKRO
+                case INTERFACE_ID_NKRO:
+                    Address = &ConfigurationDescriptor.HID_NKROHID;
+                    Size    = sizeof(USB_HID_Descriptor_HID_t);
+                    break;
+#endif
+#ifdef STENO
+                case INTERFACE_ID_Steno:
+                    Address = &ConfigurationDescriptor.HID_StenoHID;
+                    Size    = sizeof(USB_HID_Descriptor_HID_t);
+                    break;
 #endif
                 case INTERFACE_ID_Mouse:
                     Address = &ConfigurationDescriptor.HID_MouseHID;
@@ -482,6 +606,18 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue, const uint16_t wIndex
                     Address = &ExtraReport;
                     Size    = sizeof(ExtraReport);
                     break;
+#endif
+#ifdef NKRO
+                case INTERFACE_ID_NKRO:
+                    Address = &NKROReport;
+                    Size    = sizeof(NKROReport);
+                    break;
+#endif
+#ifdef STENO
+                case INTERFACE_ID_Steno:
+                    Address = &StenoReport;
+                    Size    = sizeof(StenoReport);
+                    break;
 #endif
                 case INTERFACE_ID_Mouse:
                     Address = &MouseReport;
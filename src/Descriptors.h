@@ -73,6 +73,20 @@ typedef struct {
     USB_HID_Descriptor_HID_t              HID_ExtraHID;
     USB_Descriptor_Endpoint_t             HID_ExtraReportINEndpoint;
 
+#ifdef NKRO
+    // N-key rollover HID Interface
+    USB_Descriptor_Interface_t            HID_NKROInterface;
+    USB_HID_Descriptor_HID_t              HID_NKROHID;
+    USB_Descriptor_Endpoint_t             HID_NKROReportINEndpoint;
+#endif
+
+#ifdef STENO
+    // Steno HID Interface
+    USB_Descriptor_Interface_t            HID_StenoInterface;
+    USB_HID_Descriptor_HID_t              HID_StenoHID;
+    USB_Descriptor_Endpoint_t             HID_StenoReportINEndpoint;
+#endif
+
 } USB_Descriptor_Configuration_t;
 
 /** Enum for the device interface descriptor IDs within the device. Each interface descriptor
@@ -84,6 +98,13 @@ enum InterfaceDescriptors_t {
     INTERFACE_ID_Debug    = 1,
     INTERFACE_ID_Mouse    = 2,
     INTERFACE_ID_Extra    = 3,
+#ifdef NKRO
+    INTERFACE_ID_NKRO     = 4,
+#endif
+#ifdef STENO
+    INTERFACE_ID_Steno,
+#endif
+    INTERFACE_COUNT
 };
 
 
@@ -113,6 +134,18 @@ enum StringDescriptors_t {
     #define EXTRA_IN_EPNUM MOUSE_IN_EPNUM
 #endif
 
+#ifdef NKRO
+    #define NKRO_IN_EPNUM (EXTRA_IN_EPNUM + 1)
+#endif
+
+#ifdef STENO
+    #ifdef NKRO
+        #define STENO_IN_EPNUM (NKRO_IN_EPNUM + 1)
+    #else
+        #define STENO_IN_EPNUM (EXTRA_IN_EPNUM + 1)
+    #endif
+#endif
+
 
 /// Endpoint numbers and sizes
 #define KEYBOARD_IN_EPADDR           (ENDPOINT_DIR_IN | KEYBOARD_IN_EPNUM)
@@ -127,6 +160,48 @@ enum StringDescriptors_t {
 #define EXTRA_IN_EPADDR              (ENDPOINT_DIR_IN | EXTRA_IN_EPNUM)
 #define EXTRA_EPSIZE                 8
 
+#ifdef NKRO
+#define NKRO_IN_EPADDR               (ENDPOINT_DIR_IN | NKRO_IN_EPNUM)
+#define NKRO_EPSIZE                  32
+
+/// Bitmap covers usages 0x00-0xA7, all regular keys of the keyboard usage page
+#define NKRO_KEYS_BYTES              21
+
+/** N-key rollover report: modifier byte plus one bit per key usage. */
+typedef struct {
+    uint8_t Modifier;
+    uint8_t Keys[NKRO_KEYS_BYTES];
+} __attribute__ ((packed)) USB_NKROReport_Data_t;
+
+/** HID report descriptor of USB_NKROReport_Data_t with a bitmap of KeyBytes*8 key usages,
+ *  checked against the report in the host build.
+ */
+// *INDENT-OFF*
+#define HID_DESCRIPTOR_NKRO(KeyBytes) \
+    HID_RI_USAGE_PAGE(8, 0x01),             /* Generic Desktop */ \
+    HID_RI_USAGE(8, 0x06),                  /* Keyboard */ \
+    HID_RI_COLLECTION(8, 0x01),             /* Application */ \
+        HID_RI_USAGE_PAGE(8, 0x07),         /* Key Codes */ \
+        HID_RI_USAGE_MINIMUM(8, 0xE0),      /* Left Control */ \
+        HID_RI_USAGE_MAXIMUM(8, 0xE7),      /* Right GUI */ \
+        HID_RI_LOGICAL_MINIMUM(8, 0x00), \
+        HID_RI_LOGICAL_MAXIMUM(8, 0x01), \
+        HID_RI_REPORT_SIZE(8, 0x01), \
+        HID_RI_REPORT_COUNT(8, 0x08), \
+        HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE), \
+        HID_RI_USAGE_MINIMUM(8, 0x00), \
+        HID_RI_USAGE_MAXIMUM(8, (KeyBytes)*8-1), \
+        HID_RI_REPORT_COUNT(8, (KeyBytes)*8), \
+        HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE), \
+    HID_RI_END_COLLECTION(0)
+// *INDENT-ON*
+#endif
+
+#ifdef STENO
+#define STENO_IN_EPADDR              (ENDPOINT_DIR_IN | STENO_IN_EPNUM)
+#define STENO_EPSIZE                 8
+#endif
+
 
 /* Function Prototypes: */
 uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
@@ -61,6 +61,7 @@
 #include "trackpoint.h"
 #include "macro.h"
 #include "command.h"
+#include "timer.h"
 /** Buffer to hold the previously generated HID reports, for comparison purposes inside the HID class drivers. */
 static uint8_t PrevKeyboardHIDReportBuffer[sizeof(USB_KeyboardReport_Data_t)];
 static uint8_t PrevMouseHIDReportBuffer[sizeof(USB_WheelMouseReport_Data_t)];
@@ -72,6 +73,12 @@ static uint8_t PrevMouseHIDReportBuffer[sizeof(USB_WheelMouseReport_Data_t)];
     #include "extra.h"
     static uint8_t PrevExtraHIDReportBuffer[sizeof(USB_ExtraReport_Data_t)];
 #endif
+#ifdef NKRO
+    static uint8_t PrevNKROHIDReportBuffer[sizeof(USB_NKROReport_Data_t)];
+#endif
+#ifdef STENO
+    #include "steno.h"
+#endif
 /** LUFA HID Class driver interface configuration and state information. This structure is
  *  passed to all HID Class driver functions, so that multiple instances of the same class
  *  within a device can be differentiated from one another.
@@ -149,6 +156,45 @@ USB_ClassInfo_HID_Device_t Extra_HID_Interface = {
 };
 #endif
 
+#ifdef NKRO
+USB_ClassInfo_HID_Device_t NKRO_HID_Interface = {
+    .Config =
+    {
+        .InterfaceNumber              = INTERFACE_ID_NKRO,
+
+        .ReportINEndpoint             =
+        {
+            .Address              = NKRO_IN_EPADDR,
+            .Size                 = NKRO_EPSIZE,
+            .Banks                = 1,
+        },
+
+        .PrevReportINBuffer           = PrevNKROHIDReportBuffer,
+        .PrevReportINBufferSize       = sizeof(PrevNKROHIDReportBuffer),
+    },
+};
+#endif
+
+#ifdef STENO
+/// Without a previous report buffer identical chords in a row are all sent.
+USB_ClassInfo_HID_Device_t Steno_HID_Interface = {
+    .Config =
+    {
+        .InterfaceNumber              = INTERFACE_ID_Steno,
+
+        .ReportINEndpoint             =
+        {
+            .Address              = STENO_IN_EPADDR,
+            .Size                 = STENO_EPSIZE,
+            .Banks                = 1,
+        },
+
+        .PrevReportINBuffer           = NULL,
+        .PrevReportINBufferSize       = STENO_PACKET_SIZE,
+    },
+};
+#endif
+
 
 /** Main program entry point. This routine contains the overall program flow, including initial
  *  setup of all components and the main program loop.
@@ -170,8 +216,15 @@ static void __attribute__ ((noreturn)) main_loop(void)
                 USB_Device_SendRemoteWakeup();
             }
         }
+        timer_task();
         if (USB_DeviceState != DEVICE_STATE_Suspended) {
             HID_Device_USBTask(&Keyboard_HID_Interface);
+#ifdef NKRO
+            HID_Device_USBTask(&NKRO_HID_Interface);
+#endif
+#ifdef STENO
+            HID_Device_USBTask(&Steno_HID_Interface);
+#endif
 #ifdef DEBUG_OUTPUT
             HID_Device_USBTask(&DBG_HID_Interface);
 #endif
@@ -223,6 +276,12 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 #ifdef EXTRA
     ConfigSuccess &= HID_Device_ConfigureEndpoints(&Extra_HID_Interface);
 #endif
+#ifdef NKRO
+    ConfigSuccess &= HID_Device_ConfigureEndpoints(&NKRO_HID_Interface);
+#endif
+#ifdef STENO
+    ConfigSuccess &= HID_Device_ConfigureEndpoints(&Steno_HID_Interface);
+#endif
 
     USB_Device_EnableSOFEvents();
 
@@ -232,12 +291,19 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 /** Event handler for the library USB Unhandled Control Request event. */
 void EVENT_USB_Device_ControlRequest(void)
 {
+    markReportDirty(); // e.g. boot protocol selected
     HID_Device_ProcessControlRequest(&Keyboard_HID_Interface);
 #ifdef DEBUG_OUTPUT
     HID_Device_ProcessControlRequest(&DBG_HID_Interface);
 #endif
 #ifdef EXTRA
     HID_Device_ProcessControlRequest(&Extra_HID_Interface);
+#endif
+#ifdef NKRO
+    HID_Device_ProcessControlRequest(&NKRO_HID_Interface);
+#endif
+#ifdef STENO
+    HID_Device_ProcessControlRequest(&Steno_HID_Interface);
 #endif
     HID_Device_ProcessControlRequest(&Mouse_HID_Interface);
 }
@@ -254,6 +320,12 @@ void EVENT_USB_Device_StartOfFrame(void)
 #ifdef EXTRA
     HID_Device_MillisecondElapsed(&Extra_HID_Interface);
 #endif
+#ifdef NKRO
+    HID_Device_MillisecondElapsed(&NKRO_HID_Interface);
+#endif
+#ifdef STENO
+    HID_Device_MillisecondElapsed(&Steno_HID_Interface);
+#endif
 }
 
 
@@ -297,6 +369,20 @@ bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDIn
         return false;
     }
 #endif
+#ifdef NKRO
+    else if (HIDInterfaceInfo == &NKRO_HID_Interface) {
+        USB_NKROReport_Data_t* NKROReport = (USB_NKROReport_Data_t*)ReportData;
+        *ReportSize = sizeof(USB_NKROReport_Data_t);
+        getNKROReport(NKROReport);
+        return false;
+    }
+#endif
+#ifdef STENO
+    else if (HIDInterfaceInfo == &Steno_HID_Interface) {
+        *ReportSize = steno_get_report((uint8_t*)ReportData);
+        return true;
+    }
+#endif
 
     else if (HIDInterfaceInfo == &Mouse_HID_Interface) {
         USB_WheelMouseReport_Data_t* MouseReport = (USB_WheelMouseReport_Data_t*)ReportData;
@@ -65,6 +65,8 @@
 #define LEDMASK_USB_ERROR        (LEDS_LED1 | LEDS_LED3)
 
 
+extern USB_ClassInfo_HID_Device_t Keyboard_HID_Interface;
+
 void EVENT_USB_Device_Connect(void);
 void EVENT_USB_Device_Disconnect(void);
 void EVENT_USB_Device_ConfigurationChanged(void);
@@ -281,7 +281,7 @@ char hid2asciicode(uint8_t hid, uint8_t mod)
     return ('\0');
 }
 
-#ifndef __AVR__
+#if !defined(__AVR__) && !defined(HOST)
 void main(void)
 {
     for(uint8_t i=0; i<128; ++i) {
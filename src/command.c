@@ -26,6 +26,7 @@
 #include <src/external/jump_bootloader.h>
 #include "ascii2hid.h"
 #include "print.h"
+#include "trace.h"
 #include "helpers.h"
 #include "tabularecta.h"
 #include "b64.h"
@@ -39,6 +40,9 @@
 #ifdef EXTRA
     #include "extra.h"
 #endif
+#ifdef STENO
+    #include "steno.h"
+#endif
 
 bool g_cmd_mode_active=false;
 
@@ -62,6 +66,7 @@ void setCommandMode(bool on)
 {
     if(on!=g_cmd_mode_active) {
         g_cmd_mode_active=on;
+        markReportDirty();
         subcmd = SUB_NONE;
         if(on) {
             // clean on activation
@@ -183,6 +188,25 @@ bool handleCommand(uint8_t hid_now, uint8_t mod_now)
             setCommandMode(false);
         }
         break;
+#endif
+#ifdef NKRO
+        case 'k':
+            g_cfg.fw.nkro = !g_cfg.fw.nkro;
+            xprintf("NKRO %d\n", g_cfg.fw.nkro);
+            setCommandMode(false);
+            break;
+#endif
+#ifdef STENO
+        case 's':
+            steno_enable(!steno_active());
+            setCommandMode(false);
+            break;
+#endif
+#ifdef KEY_TRACE
+        case 'T':
+            trace_dump();
+            setCommandMode(false);
+            break;
 #endif
         case 'x':
             subcmdIfUnlocked(SUB_MACRO);
@@ -27,6 +27,7 @@ void setCommandMode(bool);
 
 // encrypt/decrypt: XOR with g_pw
 int8_t decrypt(uint8_t * data, uint8_t len);
+int8_t decrypt_at(uint8_t * data, uint8_t len, uint8_t offs);
 int8_t encrypt(uint8_t * data, uint8_t len);
 
 bool commandMode(void);
@@ -168,6 +168,14 @@ enum { TP_PTS=0, TP_HALFTAC, TP_BTN2, TP_FLIPX, TP_FLIPY, TP_FLIPZ, TP_RES, TP_F
      * B= PB5, OC1A
      */
     #define HAS_I2C
+    #define MATRIX_SETTLE_US 0 // I2C transfer takes longer than needed
+    #define MCP23018_BURST_SCAN // one I2C transaction per row select and read
+    /*
+     * Optional: INTB of both MCP23018 wired together to one input, active low.
+     * Without it, idle state is detected by polling the rows of both halves.
+     */
+    //#define MCP23018_INT_PORT_LETTER B
+    //#define MCP23018_INT_BIT         4
     #define TP_AXES (1<<TP_PTS | 1<<TP_FLIPY)
 
     /* XCK for clock line and RXD for data line */
@@ -187,6 +195,51 @@ enum { TP_PTS=0, TP_HALFTAC, TP_BTN2, TP_FLIPX, TP_FLIPY, TP_FLIPZ, TP_RES, TP_F
     #endif
 #endif
 
+/*
+ * Native host build (make host): matrix is fed from a replayed trace instead of
+ * port pins, I2C expanders are simulated, see tools/host/host.c and tools/host/i2c.c
+ */
+#ifdef HOST
+    #undef  MCP23018_INT_PORT_LETTER
+    #undef  PS2MOUSE
+#endif
+
+
+/*************************************************
+ * MATRIX SCANNING
+ *************************************************/
+/*
+ * Matrix is scanned at a fixed rate from a timer interrupt, independent of host polling.
+ * Debouncing requires 4 identical consecutive scans, e.g. 8ms at 500Hz.
+ */
+#ifndef MATRIX_SCAN_HZ
+    #define MATRIX_SCAN_HZ 500
+#endif
+
+/*
+ * Time [us] for column lines to settle after a row was activated. Override per board above.
+ * In pipelined mode, the previous row is debounced during this time, and the scan timer
+ * tells how much of it is left to wait.
+ */
+#ifndef MATRIX_SETTLE_US
+    #define MATRIX_SETTLE_US 20
+#endif
+#ifndef MATRIX_SCAN_PIPELINED
+    #define MATRIX_SCAN_PIPELINED 1
+#endif
+
+/*
+ * Debounce engine, see debounce.h:
+ * DEFER adds a fixed delay of 4 scans to press and release,
+ * EAGER reports both on first edge, ASYM only the press.
+ */
+#define DEBOUNCE_DEFER 0
+#define DEBOUNCE_EAGER 1
+#define DEBOUNCE_ASYM  2
+#ifndef DEBOUNCE
+    #define DEBOUNCE DEBOUNCE_DEFER
+#endif
+
 
 // Create defines for TMK compatibility
 #define CONCAT_PORT(name)    CONCAT(PORT,name)
@@ -209,4 +262,10 @@ enum { TP_PTS=0, TP_HALFTAC, TP_BTN2, TP_FLIPX, TP_FLIPY, TP_FLIPZ, TP_RES, TP_F
 #   endif
 #endif
 
+#if defined(MCP23018_INT_PORT_LETTER) && defined(MCP23018_INT_BIT)
+#   define MCP23018_INT_PORT CONCAT_PORT(MCP23018_INT_PORT_LETTER)
+#   define MCP23018_INT_PIN  CONCAT_PIN(MCP23018_INT_PORT_LETTER)
+#   define MCP23018_INT_DDR  CONCAT_DDR(MCP23018_INT_PORT_LETTER)
+#endif
+
 
@@ -0,0 +1,96 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    Vertical counter debounce based on code from Peter Dannegger [danni/At/specs/d0t/de]
+        described in German at bottom of page
+            http://www.mikrocontroller.net/articles/Entprellung
+*/
+
+#include "debounce.h"
+
+#if DEBOUNCE == DEBOUNCE_DEFER || DEBOUNCE == DEBOUNCE_ASYM
+/// 2 bit vertical counters: one bit of each key in ct0 and ct1
+static column_size_t ct0[ROWS], ct1[ROWS];
+
+/**
+ * Count keys in i for 4 consecutive scans, any key not in i is reset.
+ * @return keys that were in i 4 times in a row.
+ */
+static inline column_size_t vc_count(uint8_t row, column_size_t i)
+{
+    ct0[row] = ~( ct0[row] & i );                   // reset or count ct0
+    ct1[row] = ct0[row] ^ (ct1[row] & i);           // reset or count ct1
+    return i & ct0[row] & ct1[row];                 // count until roll over ?
+}
+#endif
+
+#if DEBOUNCE == DEBOUNCE_EAGER || DEBOUNCE == DEBOUNCE_ASYM
+/// 2 bit vertical lockout counters: key is locked while non-zero
+static column_size_t lk0[ROWS], lk1[ROWS];
+
+/**
+ * Count down all lockout counters and return keys that were still locked.
+ */
+static inline column_size_t lock_tick(uint8_t row)
+{
+    column_size_t locked = lk0[row] | lk1[row];
+    column_size_t l0 = lk0[row];
+    lk0[row] = lk1[row] & ~l0;                      // 3->2->1->0
+    lk1[row] = lk1[row] &  l0;
+    return locked;
+}
+
+/// Lock given keys for the next 3 scans.
+static inline void lock_set(uint8_t row, column_size_t keys)
+{
+    lk0[row] |= keys;
+    lk1[row] |= keys;
+}
+#endif
+
+
+#if DEBOUNCE == DEBOUNCE_DEFER
+
+column_size_t debounce(uint8_t row, column_size_t raw, column_size_t state)
+{
+    return vc_count(row, state ^ raw);              // key changed ?
+}
+
+#elif DEBOUNCE == DEBOUNCE_EAGER
+
+column_size_t debounce(uint8_t row, column_size_t raw, column_size_t state)
+{
+    column_size_t i = (state ^ raw) & ~lock_tick(row);
+    lock_set(row, i);
+    return i;
+}
+
+#elif DEBOUNCE == DEBOUNCE_ASYM
+
+column_size_t debounce(uint8_t row, column_size_t raw, column_size_t state)
+{
+    column_size_t p = ~state & raw & ~lock_tick(row);
+    lock_set(row, p);
+    return p | vc_count(row, state & ~raw);
+}
+
+#else
+    #error "Unknown DEBOUNCE engine selected in config.h"
+#endif
@@ -0,0 +1,47 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "config.h"
+#include "keymap.h" // column_size_t
+
+/**
+ * @file debounce.h
+ *
+ * Bit-parallel debounce engines, selected at compile time via DEBOUNCE in config.h:
+ *
+ * DEBOUNCE_DEFER : Symmetric vertical counter, change reported after 4 identical scans.
+ * DEBOUNCE_EAGER : Press and release reported on first edge, then key is locked for 3 scans.
+ * DEBOUNCE_ASYM  : Press reported on first edge and locked, release deferred like above.
+ *
+ * All columns of a row are processed at once, for any width of column_size_t.
+ */
+
+/**
+ * Debounce one row.
+ *
+ * @param row   matrix row
+ * @param raw   currently read key state, bit = 1: key pressed
+ * @param state debounced key state
+ * @return      mask of keys whose debounced state toggles now
+ */
+column_size_t debounce(uint8_t row, column_size_t raw, column_size_t state);
+
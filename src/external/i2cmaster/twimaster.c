@@ -18,7 +18,9 @@
 #endif
 
 /* I2C clock in Hz */
-#define SCL_CLOCK  400000L
+#ifndef SCL_CLOCK
+    #define SCL_CLOCK  400000L
+#endif
 
 
 /*************************************************************************
@@ -26,7 +26,7 @@
 
 
 // #include "wait.h"
-#if defined(__AVR__)
+#if defined(__AVR__) || defined(HOST)
     #include <util/delay.h>
     #define wait_ms(ms)  _delay_ms(ms)
     #define wait_us(us)  _delay_us(us)
@@ -18,6 +18,7 @@
 */
 
 #include "global_config.h"
+#include "macro_heap.h"
 #include "trackpoint.h"
 /**
  * Configuration data of keyboard:
@@ -54,6 +55,10 @@ void init_config()
     g_cfg.tp_config.speed = TP_DEF_SPEED;  // 0x61
     g_cfg.tp_config.thres = TP_DEF_THRESH; // 0x08
 #endif
+#ifdef NKRO
+    // hosts selecting the boot protocol still get the 6 key report
+    g_cfg.fw.nkro = 1;
+#endif
 
     print_config();
 
@@ -67,6 +72,7 @@ void init_config()
         xprintf("\nEE magic OK");
         load_config(&g_cfg);
     }
+    macro_heap_init();
 
     print_config();
 }
@@ -84,6 +90,9 @@ void print_config()
 #ifdef ALTERNATE_LAYER
     xprintf(" AL=%d", g_cfg.fw.alt_layer);
 #endif
+#ifdef NKRO
+    xprintf(" NKRO=%d", g_cfg.fw.nkro);
+#endif
 #ifdef PS2MOUSE
     xprintf("\nTP: Sens: %3d/%3d SP=%3d TH=%3d ", g_cfg.tp_config.sensL, g_cfg.tp_config.sens, g_cfg.tp_config.speed, g_cfg.tp_config.thres);
     xprintf("\nPTS=%1X X=%1X Y=%1X (%0X)",g_cfg.tp_axis.pts, g_cfg.tp_axis.flipx, g_cfg.tp_axis.flipy, g_cfg.tp_axis.raw);
@@ -64,19 +64,18 @@
 /// NOTE: This address is compile-time checked against config size in init_config() via ct_assert()
 #define EE_ADDR_START       200
 
-// @TODO refactor to adjust after changes to macro count and max len
-//       or use from end of eeprom ...
-#define EE_ADDR_MACRO_MAP   (EE_ADDR_START) // mapping of characters to id
-#define EE_ADDR_MACROS      (EE_ADDR_MACRO_MAP + MACROCOUNT)
-#define EE_ADDR_MACRO(idx)  (EE_ADDR_MACROS    + ((idx%MACROCOUNT)*(MACRO_MAX_LEN+1)))
+// Macro heap, see macro_heap.h: two slots for its tail position, then the log up to the tag
+#define EE_ADDR_MACRO_TAIL  (EE_ADDR_START)
+#define EE_ADDR_MACRO_HEAP  (EE_ADDR_MACRO_TAIL + 2*4)
+#define EE_MACRO_HEAP_SIZE  (EE_ADDR_TAG - EE_ADDR_MACRO_HEAP)
 
 // From end of EEPROM
 #define EE_TAG_LEN  20
 #define EE_ADDR_TAG         (E2END - EE_TAG_LEN)
 
-// Check that macros fit into given eeprom
-#if EE_ADDR_MACRO(MACROCOUNT) > EE_ADDR_TAG
-    #error EEPROM macro storage too large.
+// Check that a maximum length record and its copy fit into given eeprom
+#if EE_MACRO_HEAP_SIZE < 3*(4+255)
+    #error EEPROM macro heap too small.
 #endif
 
 
@@ -92,7 +91,8 @@ typedef union {
         bool alt_layer:1;
         bool mouse_enabled:1;
         bool swap_xy:1;
-        uint8_t fw_config_unused:4;
+        bool nkro:1;
+        uint8_t fw_config_unused:3;
     };
     uint8_t raw;
 } fw_config_t;
@@ -127,7 +127,7 @@ typedef union {
 /// led config, used regularly to update LED
 typedef struct {
     uint8_t r, g, b;
-    // in 100ms, roughly based on idle_count updates via ISR
+    // in 16ms steps of timer_read()
     uint8_t on;
     uint8_t off;
 } led_t;
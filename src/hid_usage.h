@@ -61,6 +61,7 @@
 
 #define HID_NO_KEY          0
 #define HID_ERROR_ROLLOVER  1
+#define HID_TRANSPARENT     HID_ERROR_ROLLOVER // keymap only: use key of next lower active layer
 #define HID_POST_FAIL       2
 #define HID_ERROR_UNDEFINED 3
 #define HID_A               4
@@ -272,6 +273,9 @@
 #define MODHID_MASK   0x20
 #define TAPPING_MASK  0x40
 #define LAYER_MASK    0x80
+/// Activation of layer keys, momentary if neither is set. The layer number is in the lower nibble.
+#define LAYER_TOGGLE  MODKEY_MASK
+#define LAYER_ONESHOT MODHID_MASK
 // encode actual modifier bit in lower nibble.
 #define HID_MOD_MASK(mod) (mod & (MODKEY_MASK|MODHID_MASK) ? 1<<(mod&0x0F) : 0)
 
@@ -391,6 +395,7 @@ AltGr  :           7 8 9 0 ß   q e     +       <
 */
 
 #define _no         { 0,     0 /*,      ' ' */ } // No key defined
+#define _trns       { HID_TRANSPARENT, 0 }          // Key of next lower active layer
 
 #define _1          { HID_1, 0 /*,      '1' */ }
 #define _EXCLAM     { HID_1, SHIFT  /*, '!' */ }
@@ -485,6 +490,8 @@ AltGr  :           7 8 9 0 ß   q e     +       <
 #define _MOD_2      { HID_NO_KEY,       MOD_LAYER_2  /*, ' ' */ }
 #define _MOD_3      { HID_NO_KEY,       MOD_LAYER_3  /*, ' ' */ }
 #define _MOD_MOUSEKEY { HID_NO_KEY,     MOD_MOUSEKEY /*, ' ' */ }
+#define _TOGGLE(l)  { HID_NO_KEY,       LAYER_MASK | LAYER_TOGGLE  | (l) }  //  layer on/off
+#define _ONESHOT(l) { HID_NO_KEY,       LAYER_MASK | LAYER_ONESHOT | (l) }  //  layer for next key
 #define _COMPOSE    { HID_NO_KEY,       MOD_COMPOSE  /*, ' ' */ }
 
 #define _MS_SCROLL   { MS_SCROLL,0 /*,    ' ' */ }
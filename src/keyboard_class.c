@@ -44,6 +44,11 @@
 #include "tabularecta.h"
 
 #include "global_config.h"
+#include "timer.h"
+#include "trace.h"
+#ifdef STENO
+    #include "steno.h"
+#endif
 #ifdef PS2MOUSE
     #include "trackpoint.h"
 #endif
@@ -61,30 +66,35 @@ uint8_t getModifier(uint8_t row, uint8_t col, uint8_t layer);
 
 uint8_t getActiveModifiers(void);
 uint8_t getActiveLayer(void);
-uint8_t getActiveKeyCodeModifier(void);
+static keycode getLayerKey(uint8_t row, uint8_t col);
 
 void reportPrint (USB_KeyboardReport_Data_t * report, char * str);
 void printKeys(void);
 
 void zeroReport(USB_KeyboardReport_Data_t *report_data) { memset(report_data, 0, 8); }
 
+void keyIdChange(uint8_t row, uint8_t col, uint8_t change, uint16_t time);
+void processKeyEvents(void);
+
 
-uint32_t g_last_activity; // idle_count at last pressed key
+uint16_t g_last_activity; // timer_read_s() at last pressed key
 /**
- * Timeouts in idle_count ticks = x/61 [s]
+ * Timeouts in ms
  *
- * If pressed _and_ released within the timeout (and without any other key presses or releases in between)
- * a dual use key will be interpreted with its tapped meaning, usually a regular printable character.
- * Otherwise, its regular meaning (typically as a modifier) is assumed.
+ * If pressed _and_ released within its tapping term a dual use key will be interpreted with its
+ * tapped meaning, usually a regular printable character. Otherwise, its regular meaning
+ * (typically as a modifier) is assumed. Keys without an entry in DualUseKeys[] use this term.
  */
-#define TAP_TIMEOUT        30
+#define TAP_TIMEOUT        500
 /**
  * If a released dual use key was tapped and pressed again within the repeat timeout, it is continuously
  * interpreted as tapped key until released.
  */
-#define TAP_TIMEOUT_REPEAT 10
-
-#define MAX_ACTIVE_KEYS 10
+#define TAP_TIMEOUT_REPEAT 160
+/**
+ * Default window for all keys of a combo to be pressed, see ComboKeys[].
+ */
+#define COMBO_TIMEOUT      50
 
 typedef struct {
     union {
@@ -98,46 +108,97 @@ typedef struct {
     union {
         struct {
             bool    dual:1;
-            uint8_t state:3;
-            bool    layer:1;
-            bool    mod:1;
-            bool    mouse:1;
-            bool    unused:1;
+            uint8_t state:3;    ///< DualUsageMode
+            bool    layer:1;    ///< layer key in layer 0
+            bool    mod:1;      ///< modifier key in layer 0
+            bool    mouse:1;    ///< has a mouse key assigned
+            bool    normal:1;   ///< neither layer nor modifier key in layer 0
         };
         uint8_t mode;
     };
 
+    uint8_t action:4;   ///< layer 0 modifier bit, layer step for layer keys, or combo index
+    bool    sent:1;     ///< normal key was already reported to host
+    bool    combo:1;    ///< stands in for a combo, sends its key instead
+    bool    fresh:1;    ///< pressed since the last report was built
+
 } keypress_t;
 
 
-keypress_t lastDualUseKey;
-keypress_t activeKeys[MAX_ACTIVE_KEYS];
+/**
+ * Pressed keys are kept as one bitmap per row for set-bit iteration, and a
+ * doubly linked list over key indices (row*COLS+col) that keeps the order of
+ * presses for the report. Adding and removing are O(1) and every key fits.
+ */
+#define KEY_COUNT (ROWS*COLS)
+#define KEY_NONE  0xFF
+
+#if KEY_COUNT >= KEY_NONE
+    #error "Key index must fit into 8 bit"
+#endif
+
+static column_size_t keystate[ROWS];
+static keypress_t keyinfo[KEY_COUNT];   ///< resolved at press time, valid while pressed
+static uint8_t key_next[KEY_COUNT], key_prev[KEY_COUNT];
+static uint8_t key_first = KEY_NONE, key_last = KEY_NONE;
 
 uint8_t activeKeyCount;
 
+/**
+ * Set whenever the keyboard report may change: key changes, dual use taps, macro output,
+ * mouse and command mode, host requests. Otherwise the cached report is sent again.
+ */
+static bool report_dirty = true;
+
 
 enum DualUsageMode {
-    DUAL_NONE,              // init, or released as mod
+    DUAL_NONE,              // regular meaning, or not a dual use key
     DUAL_UNDECIDED,         // tap not yet determined
-    DUAL_NO_TAP,            // no tap, timed out
+    DUAL_HOLD,              // held, regular meaning
     DUAL_TAPPED,            // was tapped
-    DUAL_TAPPED_NOW_HELD,   // was tapped and now held
+    DUAL_TAPPED_NOW_HELD,   // was tapped and pressed again, held as tapped key
 };
 
+/**
+ * Dual use keys are decided from a queue of key events: its head is the press of the
+ * oldest undecided dual use key, followed by all later events that depend on its meaning.
+ * Once the head is decided as tap or hold, the remaining events are replayed and may in
+ * turn queue the next undecided dual use key. Any number of them can thus be rolled.
+ */
+#define DUAL_QUEUE_SIZE 8
+
+static keyevent_t dual_queue[DUAL_QUEUE_SIZE];
+static uint8_t    dual_queued;          ///< events in queue
+static bool       dual_replay;          ///< queue holds events to replay instead of an undecided head
+static dualuse_t  dual_head;            ///< term and policy of the undecided head
+static uint8_t    dual_tap;             ///< layer 0 hid of the last tapped dual use key
+static uint8_t    dual_tap_reports;     ///< 2: send tap, 1: send release, 0: done
+static uint8_t    dual_last_tap = 0xFF; ///< id of the last tapped key until another event is applied
+static uint16_t   dual_last_tap_time;
 
 /**
-  * ISR that should get called 61 times a second.
-  * Allows exact timers
-  */
-ISR(TIMER0_OVF_vect)
-{
-    ++idle_count;
-    /// @todo What happens on overflow? with 61/s and 16bit=65536
-    // (2^15-1)/61/60        ~= 9 minutes till overflow
-    // (2^31-1)/61/60/60/24   = 407 days should suffice...
-    if(idle_count<0)
-        idle_count=0;
-}
+ * Presses of keys that are part of a combo are held back as long as a combo of all
+ * of them may still be completed in time. A matched combo is added as one key at the
+ * position of its first key, and released with any of its keys.
+ */
+static keyevent_t    combo_keys[COMBO_KEYS]; ///< held back presses
+static uint8_t       combo_pending;          ///< number of held back presses
+static uint8_t       combo_candidates;       ///< combos containing all held back keys
+static column_size_t combo_held[ROWS];       ///< keys of matched combos, releases are consumed
+
+/**
+ * Layer stack: one bit per layer, layer 0 is always active. Held layer keys, toggled
+ * and one-shot layers each keep their own mask. On every change the highest active
+ * layer is stored, where keys are looked up and fall through transparent entries.
+ */
+#define LAYER_ALL ((uint16_t)((1UL<<LAYERS)-1))
+
+static uint16_t layer_held;                 ///< layers of held momentary layer keys
+static uint16_t layer_toggled;              ///< layers switched on by toggle keys
+static uint16_t layer_oneshot;              ///< layers active until next key is released
+static uint16_t layer_active = 1;           ///< union of the above and layer 0
+static uint8_t  layer_top;                  ///< highest bit in layer_active
+static uint8_t  layer_oneshot_key = KEY_NONE; ///< key that releases one-shot layers
 
 
 /**
@@ -145,11 +206,10 @@ ISR(TIMER0_OVF_vect)
  */
 void initKeyboard()
 {
-    idle_count=0;
-
     set_led_color(16,0,0);
 
     init_cols();
+    init_scan_timer();
 
     set_led_color(0,16,0);
 
@@ -170,99 +230,237 @@ void initKeyboard()
 }
 
 
+void markReportDirty(void)
+{
+    report_dirty = true;
+}
+
+
+#ifdef NKRO
+static USB_NKROReport_Data_t nkro_report;
+
+/// NKRO interface is used only if enabled and host did not select boot protocol.
+static inline bool nkroActive(void)
+{
+    return g_cfg.fw.nkro && Keyboard_HID_Interface.State.UsingReportProtocol;
+}
+
+static inline void nkroAddKey(uint8_t hid)
+{
+    if(hid < NKRO_KEYS_BYTES*8)
+        nkro_report.Keys[hid>>3] |= (1<<(hid&7));
+}
+
+/**
+ * Report for the NKRO interface, as assembled during the last getKeyboardReport().
+ */
+uint8_t getNKROReport(USB_NKROReport_Data_t *report_data)
+{
+    memcpy(report_data, &nkro_report, sizeof(nkro_report));
+    return sizeof(nkro_report);
+}
+#endif
+
+/**
+ * Keys pressed until now are part of the report just built. Polls that send macro
+ * output or a cached report leave them fresh, so a release is deferred until then.
+ */
+static void keysReported(void)
+{
+    for(uint8_t k=key_first; k!=KEY_NONE; k=key_next[k])
+        keyinfo[k].fresh = false;
+}
+
 /**
  * This function is periodically called from host.
  *
  * Last chance to modify the data being sent.
  *
  * Logical flow:
- *   - scan matrix -> keyChange() which in turn updates dual usage state
+ *   - drain key events queued by scan_matrix() -> keyIdChange() which in turn updates dual usage state
  *   - check overrides like macro or passhash playback
+ *   - return the cached report unless marked dirty since
  *   - fill report with keyboard data.
  *
  *
  */
 uint8_t getKeyboardReport(USB_KeyboardReport_Data_t *report_data)
 {
+    static USB_KeyboardReport_Data_t kb_report;
+
 #ifdef HAS_LED
     set_led();
 #endif
 
+#ifndef MATRIX_SCAN_IN_ISR
     scan_matrix();
+#endif
+    processKeyEvents();
 
 #ifdef ANALOGSTICK
     analogDataAcquire();
 #endif
 
+    if(0 < activeKeyCount) {
+        g_last_activity = timer_read_s();
+    } else if( unlocked() && timer_elapsed_s(g_last_activity) > 60*60U) {
+        lock();
+    }
+
     // send pending data to output like a macro or passhash
     if(printOutstr(report_data)) {
+#ifdef NKRO
+        memset(&nkro_report, 0, sizeof(nkro_report));
+#endif
+        report_dirty = true;
         return sizeof(USB_KeyboardReport_Data_t);
     }
 
-    if(useAsMouseReport())
+    if(!report_dirty) {
+        memcpy(report_data, &kb_report, sizeof(kb_report));
+        return sizeof(USB_KeyboardReport_Data_t);
+    }
+    report_dirty = false;
+#ifdef NKRO
+    memset(&nkro_report, 0, sizeof(nkro_report));
+#endif
+
+    if(useAsMouseReport()) {
+        dual_tap_reports = 0; // tap is lost in mouse mode, do not stall queued keys
+        report_dirty = true;  // mouse keys are evaluated on every report
+        keysReported();
         return 0;
+    }
 
     fillKeyboardReport(report_data);
+    keysReported();
 
     // clear report in command mode to disable echoing of selected commands.
-    if( handleCommand(report_data->KeyCode[0], report_data->Modifier) )
+    if( handleCommand(report_data->KeyCode[0], report_data->Modifier) ) {
         zeroReport(report_data);
+#ifdef NKRO
+        memset(&nkro_report, 0, sizeof(nkro_report));
+#endif
+    }
+
+    trace_report(report_data, timer_read());
 
+#ifdef NKRO
+    // keys are sent via NKRO interface only
+    if(nkroActive())
+        zeroReport(report_data);
+#endif
+
+    memcpy(&kb_report, report_data, sizeof(kb_report));
     return sizeof(USB_KeyboardReport_Data_t);
 }
 
 
+/**
+ * Build the report from the resolved keys in press order.
+ *
+ * Modifiers are summed up from the press time resolution, and only keys that
+ * make it into the report are looked up in the layer stack.
+ * With NKRO active, all keys are added to its bitmap, the 6 slots are still
+ * filled for command mode.
+ *
+ * Normal keys may imply a modifier, e.g. "q"+"AltGr" for "@" on a german PC layout,
+ * which must be active when the host first sees the key. The report therefore uses
+ * the implicit modifier of the newest key. Keys not yet reported are added in press
+ * order as long as they imply the same modifier, others follow in the next report.
+ * Without conflicting keys, all are sent at once.
+ */
 void fillKeyboardReport(USB_KeyboardReport_Data_t *report_data)
 {
-    uint8_t activeLayer = getActiveLayer();
-
     uint8_t idx=0;
     uint8_t kc;
+#ifdef NKRO
+    bool nkro = nkroActive();
+#else
+    const bool nkro = false;
+#endif
+#ifdef HOST
+    ++host_report_builds;
+#endif
 
     //@TODO modified characters like "@" or "%" ? Unlikely, but currently not supported...
-    if(lastDualUseKey.state == DUAL_TAPPED || lastDualUseKey.state == DUAL_TAPPED_NOW_HELD) {
-        kc = getKeyCode(lastDualUseKey.row, lastDualUseKey.col, 0);
-        report_data->KeyCode[idx]= kc;
-        idx++;
-        if(lastDualUseKey.state == DUAL_TAPPED)
-            lastDualUseKey.state = DUAL_NONE; // remove after handling
-
-    }
-
-    if(0 < activeKeyCount) {
-        g_last_activity = idle_count;
-    } else if( unlocked() && (idle_count > g_last_activity + 61*60*60UL)) {
-        lock();
+    // A tap is sent in one report and released in the next, so that repeated taps are seen.
+    if(dual_tap_reports) {
+        if(dual_tap_reports == 2) {
+            report_data->KeyCode[idx++] = dual_tap;
+#ifdef NKRO
+            if(nkro)
+                nkroAddKey(dual_tap);
+#endif
+        }
+        if(--dual_tap_reports)
+            report_dirty = true;
     }
 
-    for(uint8_t i=0; i < activeKeyCount; ++i) {
-        uint8_t row = activeKeys[i].row;
-        uint8_t col = activeKeys[i].col;
+    uint8_t modifiers=0;
 
+    for(uint8_t k=key_first; k!=KEY_NONE; k=key_next[k]) {
+        keypress_t *key = &keyinfo[k];
+        if(key->state == DUAL_TAPPED_NOW_HELD)
+            continue;
+        if(key->mod)
+            modifiers |= (1<<key->action);
+    }
 
-        kc = getKeyCode(row, col, activeLayer);
-        if(isNormalKey(row,col) && idx < 6) {
-            report_data->KeyCode[idx]= kc;
-            idx++;
-        }
+    uint8_t keyCodeModifier=0;  // implicit modifier of newest key in report
+    uint8_t newModifier=0;      // implicit modifier of keys reported for the first time
+    bool    added=false;        // keys are reported for the first time
+    bool    deferred=false;     // keys with conflicting implicit modifier wait for next report
 
-        // @TODO Hack to be able to use Int1 as Hyper modifier
-        // It should be handled as a modifier in all regards up until sending
-        // Thus HID_R_GUI is used until here, and now replaced here and at modifiers below...
-        if ( kc == HID_R_GUI && idx<6) {
-            report_data->KeyCode[idx]= HID_INT1;
-            idx++;
+    for(uint8_t k=key_first; k!=KEY_NONE && (idx<6 || nkro); k=key_next[k]) {
+        keypress_t *key = &keyinfo[k];
+        if(key->state == DUAL_TAPPED_NOW_HELD) {
+            kc = getKeyCode(key->row, key->col, 0);
+        } else if(key->layer) {
+            continue;
+        } else if(key->mod) {
+            // @TODO Hack to be able to use Int1 as Hyper modifier
+            // It should be handled as a modifier in all regards up until sending
+            // Thus HID_R_GUI is used until here, and now replaced here and at modifiers below...
+            if(key->action != MOD_R_GUI-MOD_FIRST)
+                continue;
+            kc = HID_INT1;
+        } else {
+            keycode code = key->combo ? getCombo(key->action).kc
+                                      : getLayerKey(key->row, key->col);
+            if( HID_CMDMODE == code.hid )
+                goto cmdmode;
+
+            kc = code.hid;
+            uint8_t implicit = (code.mods & MODHID_MASK) ? (1<<(code.mods&0x0F)) : 0;
+            if(!key->sent) {
+                if(deferred || (added && implicit != newModifier)) {
+                    deferred = true;
+                    continue;
+                }
+                added = true;
+                newModifier = implicit;
+                key->sent = true;
+            }
+            keyCodeModifier = implicit;
         }
 
-        if( HID_CMDMODE == getKeyCode(row, col, activeLayer) )
-            goto cmdmode;
-
-        if(idx>=6)
-            break;
+        if(idx<6)
+            report_data->KeyCode[idx++] = kc;
+#ifdef NKRO
+        if(nkro)
+            nkroAddKey(kc);
+#endif
     }
 
-    report_data->Modifier=getActiveModifiers()|getActiveKeyCodeModifier();
+    if(deferred)
+        report_dirty = true;
+
+    report_data->Modifier = modifiers | keyCodeModifier;
     report_data->Modifier &= ~(1<<(MOD_R_GUI-MOD_FIRST));
+#ifdef NKRO
+    nkro_report.Modifier = report_data->Modifier;
+#endif
 
     // Activate for trace
     // reportPrint(report_data, "");
@@ -271,6 +469,9 @@ void fillKeyboardReport(USB_KeyboardReport_Data_t *report_data)
 cmdmode:
     setCommandMode(true);
     zeroReport(report_data);
+#ifdef NKRO
+    memset(&nkro_report, 0, sizeof(nkro_report));
+#endif
 }
 
 
@@ -287,6 +488,28 @@ void reportPrint(USB_KeyboardReport_Data_t * report, char * str)
 }
 
 
+#ifdef HAS_LED
+static uint16_t led_step;   ///< timer_read() at the last blink step
+static uint8_t  led_phase;  ///< blink steps into the current on or off time
+static bool     led_lit;
+
+/**
+ * Blink state: on for g_cfg.led.on and off for g_cfg.led.off+1 steps of 16 ms.
+ * Steps are counted with timer_elapsed(), so the pattern runs on across timer wrap.
+ */
+bool led_blink(void)
+{
+    while(timer_elapsed(led_step) >= 16) {
+        led_step += 16;
+        if(led_lit ? ++led_phase >= g_cfg.led.on : led_phase++ >= g_cfg.led.off) {
+            led_lit   = !led_lit;
+            led_phase = 0;
+        }
+    }
+    return led_lit;
+}
+#endif
+
 /**
  * Set led blink mode to current configured state in g_cfg.led.
  */
@@ -320,7 +543,7 @@ void set_led()
     }
 
     // global blinking:
-    if(idle_count % (g_cfg.led.on+g_cfg.led.off+1)  < g_cfg.led.on) // +1 needed for mod 0 ?
+    if(led_blink())
         set_led_color(g_cfg.led.r, g_cfg.led.g, g_cfg.led.b);
     else
         set_led_color(0,0,0);
@@ -341,52 +564,106 @@ void set_led_color(uint8_t r, uint8_t g, uint8_t b)
 }
 
 
-/// @todo Switch back from mouse layer!
+/// Highest active layer of the layer stack.
 uint8_t getActiveLayer()
 {
-    uint8_t layer=0;
-    for(uint8_t i=0; i < activeKeyCount; ++i) {
-        uint8_t row = activeKeys[i].row;
-        uint8_t col = activeKeys[i].col;
-        if(activeKeys[i].id == lastDualUseKey.id && lastDualUseKey.state != DUAL_NO_TAP)
-            continue;
-        if( isLayerKey(row, col)) {
-            layer += (getModifier(row, col,0)&0x0F);
-        }
+    return layer_top;
+}
+
+/// Recalculate the active layers after a change of any of the masks.
+static void updateLayers(void)
+{
+    uint16_t held = 0;
+    for(uint8_t k=key_first; k!=KEY_NONE; k=key_next[k]) {
+        if(keyinfo[k].layer && keyinfo[k].state != DUAL_TAPPED_NOW_HELD)
+            held |= (1U<<keyinfo[k].action);
     }
-    return layer;
+    layer_held = held;
+
+    layer_active = ((layer_held | layer_toggled | layer_oneshot) & LAYER_ALL) | 1;
+    layer_top = sizeof(unsigned)*8-1 - __builtin_clz(layer_active);
+    report_dirty = true;
 }
 
 /**
- *  Returns the modifier needed to send first normal key in active keys.
- *  Example: For "@" on a german PC layout "q"+"AltGr" needs to be send to host.
- *  @todo : Where are the other keys parsed? Would need to split a report in case
- *          another modifier is pressed or needed for later characters.
+ * Key at row/col in the highest active layer, or the next lower active layer
+ * where it is transparent. Layer 0 entries are used as they are.
  */
-uint8_t getActiveKeyCodeModifier()
+static keycode getLayerKey(uint8_t row, uint8_t col)
 {
-    for(uint8_t i=0; i < activeKeyCount; ++i) {
-        if(activeKeys[i].id == lastDualUseKey.id && lastDualUseKey.state != DUAL_NO_TAP)
-            continue;
-        if( isNormalKey(activeKeys[i].row, activeKeys[i].col)) {
-            uint8_t mod = getModifier(activeKeys[i].row, activeKeys[i].col, getActiveLayer());
-            if(mod & MODHID_MASK)
-                return (1<<(mod&0x0F));
-            return 0;
+    keycode kc = getKeyStruct(row, col, layer_top);
+
+    for(uint8_t layer=layer_top; kc.hid == HID_TRANSPARENT && layer--; ) {
+        if(layer_active & (1U<<layer))
+            kc = getKeyStruct(row, col, layer);
+    }
+    if(kc.hid == HID_TRANSPARENT)
+        kc.hid = HID_NO_KEY;
+    return kc;
+}
+
+/**
+ * Layer handling of a newly pressed key.
+ *
+ * Keys that are regular in layer 0 but layer keys in the active layer turn into layer
+ * keys until released. Toggle and one-shot keys switch their layer on press only and
+ * are then kept as layer keys for layer 0, i.e. without effect. The next regular key
+ * pressed with one-shot layers active releases them along with its own release.
+ */
+static void layerKeyPress(uint8_t k)
+{
+    keypress_t *key = &keyinfo[k];
+    uint8_t mods;
+
+    if(key->state == DUAL_TAPPED_NOW_HELD)
+        return;
+    if(key->layer) {
+        mods = getModifier(key->row, key->col, 0);
+    } else if(key->normal) {
+        keycode kc = getLayerKey(key->row, key->col);
+        if(!(kc.mods & LAYER_MASK)) {
+            if(layer_oneshot && layer_oneshot_key == KEY_NONE)
+                layer_oneshot_key = k;
+            return;
         }
+        mods = kc.mods;
+        key->normal = false;
+        key->layer  = true;
+        key->action = mods & 0x0F;
+    } else {
+        return;
+    }
+
+    if(mods & LAYER_TOGGLE) {
+        layer_toggled ^= (1U<<key->action);
+        key->action = 0;
+    } else if(mods & LAYER_ONESHOT) {
+        layer_oneshot |= (1U<<key->action);
+        key->action = 0;
+    }
+    updateLayers();
+}
+
+/// Layer handling of a released key, after it is removed from the pressed keys.
+static void layerKeyRelease(uint8_t k)
+{
+    if(k == layer_oneshot_key) {
+        layer_oneshot = 0;
+        layer_oneshot_key = KEY_NONE;
+        updateLayers();
+    } else if(keyinfo[k].layer) {
+        updateLayers();
     }
-    return 0;
 }
 
-// Assuming there is only one active key
 uint8_t getActiveModifiers()
 {
     uint8_t modifiers=0;
-    for(uint8_t i=0; i < activeKeyCount; ++i) {
-        if(activeKeys[i].id == lastDualUseKey.id && lastDualUseKey.state != DUAL_NO_TAP)
-            continue;
-        if( isModifierKey(activeKeys[i].row, activeKeys[i].col)) {
-            modifiers += (1<< (getModifier(activeKeys[i].row, activeKeys[i].col,0)&0x0F));
+    for(uint8_t row=0; row<ROWS; ++row) {
+        for(column_size_t c=keystate[row]; c; c &= c-1) {
+            keypress_t *key = &keyinfo[row*COLS+column_ffs(c)];
+            if(key->mod && key->state != DUAL_TAPPED_NOW_HELD)
+                modifiers |= (1<<key->action);
         }
     }
     return modifiers;
@@ -409,7 +686,10 @@ void led(uint8_t n)
  */
 bool suspend_wakeup_condition()
 {
+#ifndef MATRIX_SCAN_IN_ISR
     scan_matrix();
+#endif
+    processKeyEvents();
     return (activeKeyCount>2);
 }
 
@@ -464,6 +744,7 @@ void enable_mouse_keys(uint8_t on)
         // e.g: Start command mode, change some values there, move mouse and while it
         // is still enabled leave command mode...
         //set_led_mode(LED_MOUSE, on); // -> OCR4D= (on ? 20 : 0);
+        report_dirty = true;
     }
     g_mouse_keys_enabled = on;
 }
@@ -489,9 +770,7 @@ void SetupHardware()
     LEDs_Init();
     USB_Init();
 
-    // set up timer
-    TCCR0A = 0x00;
-    TCCR0B = 0x05;
+    timer_init();
 
 #ifdef HAS_LED
     // @TODO tensy++2.0 at90usb1286 does not have 4th timer?
@@ -506,8 +785,6 @@ void SetupHardware()
     initPWM();
 #endif
 
-    TIMSK0 = (1<<TOIE0);
-
     /* Task init */
     initKeyboard();
 }
@@ -519,10 +796,14 @@ bool useAsMouseReport(void)
     // @TODO check for mousemode should go directly into descriptor polling
     if(getActiveLayer() == (MOD_MOUSEKEY-MOD_LAYER_0) ) {
         uint16_t mk_mask=0;
-        for(uint8_t i=0; i < activeKeyCount; ++i) {
-            uint8_t mk_key = getKeyCode(activeKeys[i].row, activeKeys[i].col, (MOD_MOUSEKEY-MOD_LAYER_0));
-            if(mk_key != 0)
+        for(uint8_t row=0; row<ROWS; ++row) {
+            for(column_size_t c=keystate[row]; c; c &= c-1) {
+                uint8_t col = column_ffs(c);
+                if(!keyinfo[row*COLS+col].mouse)
+                    continue;
+                uint8_t mk_key = getKeyCode(row, col, (MOD_MOUSEKEY-MOD_LAYER_0));
                 mk_mask |= (1<<(mk_key-MS_BEGIN));
+            }
         }
         mousekey_activate(mk_mask);
         return true;
@@ -540,32 +821,64 @@ bool useAsMouseReport(void)
 uint8_t getMouseKeyButtonMask(void)
 {
     uint8_t btns=0;
-    for(uint8_t i=0; i<activeKeyCount; ++i) {
-        uint8_t mk = getMouseKey(activeKeys[i].row, activeKeys[i].col);
-        if(mk>=MS_BTN1 && mk<=MS_BTN5)
-            btns |= (1<<(mk-MS_BTN1));
+    for(uint8_t row=0; row<ROWS; ++row) {
+        for(column_size_t c=keystate[row]; c; c &= c-1) {
+            uint8_t col = column_ffs(c);
+            if(!keyinfo[row*COLS+col].mouse)
+                continue;
+            uint8_t mk = getMouseKey(row, col);
+            if(mk>=MS_BTN1 && mk<=MS_BTN5)
+                btns |= (1<<(mk-MS_BTN1));
+        }
     }
     return btns;
 }
 
 
+/**
+ * Classify a key from its layer 0 entry, once when pressed.
+ * Keys that are modifiers or layer keys in layer 0 are treated as such in all layers.
+ */
+static keypress_t resolveKey(uint8_t row, uint8_t col)
+{
+    keycode kc = getKeyStruct(row, col, 0);
+    keypress_t key = { .row=row, .col=col };
+
+    key.dual   = (kc.mods & TAPPING_MASK) != 0;
+    key.layer  = (kc.mods & LAYER_MASK)   != 0;
+    key.mod    = (kc.mods & (MODKEY_MASK|LAYER_MASK)) == MODKEY_MASK;
+    key.normal = !(key.layer || key.mod);
+    key.mouse  = getMouseKey(row, col)    != 0;
+    key.action = kc.mods & 0x0F;
+    return key;
+}
+
 void addKey(uint8_t row, uint8_t col)
 {
-    if(activeKeyCount>=MAX_ACTIVE_KEYS-1) {
+    column_size_t bit = (column_size_t)1<<col;
+    if(keystate[row] & bit) {
         xprintf("\nErr: +");
-        printKeys();
-        activeKeyCount=0;
         return;
     }
-    activeKeys[activeKeyCount].row=row;
-    activeKeys[activeKeyCount].col=col;
-    //activeKeys[activeKeyCount].hid=getModifier(row, col);
-    //activeKeys[activeKeyCount].mod=getModifier(row, col);
+    keystate[row] |= bit;
+    report_dirty = true;
+
+    // append to press order list
+    uint8_t k = row*COLS+col;
+    keyinfo[k]  = resolveKey(row, col);
+    keyinfo[k].fresh = true;
+    key_next[k] = KEY_NONE;
+    key_prev[k] = key_last;
+    if(key_last != KEY_NONE)
+        key_next[key_last] = k;
+    else
+        key_first = k;
+    key_last = k;
     ++activeKeyCount;
 
     // immediately exit mouse mode on non-mousekey press.
     if( g_mouse_keys_enabled ) {
-        if(! getMouseKey(row, col))
+        if(! keyinfo[k].mouse)
             enable_mouse_keys(0);
     }
 }
@@ -573,46 +886,364 @@ void addKey(uint8_t row, uint8_t col)
 
 void delKey(uint8_t row, uint8_t col)
 {
-    if(activeKeyCount<1) {
+    column_size_t bit = (column_size_t)1<<col;
+    if(!(keystate[row] & bit)) {
         xprintf("\nErr: -");
         return;
     }
-    for(uint8_t i=activeKeyCount-1; i>=0; --i) {
-        if(activeKeys[i].row == row && activeKeys[i].col == col) {
-            activeKeys[i] = activeKeys[activeKeyCount-1];
-            --activeKeyCount;
-            return;
-        }
-    }
+    keystate[row] &= ~bit;
+    report_dirty = true;
+
+    // unlink from press order list
+    uint8_t k = row*COLS+col;
+    if(key_prev[k] != KEY_NONE)
+        key_next[key_prev[k]] = key_next[k];
+    else
+        key_first = key_next[k];
+    if(key_next[k] != KEY_NONE)
+        key_prev[key_next[k]] = key_prev[k];
+    else
+        key_last = key_prev[k];
+    --activeKeyCount;
+
+    layerKeyRelease(k);
 }
 
 
 void printKeys(void)
 {
     xprintf("%d: ", activeKeyCount);
-    if(lastDualUseKey.state != DUAL_NONE) {
-        xprintf("DU %1X%1X=%1d|", lastDualUseKey.row, lastDualUseKey.col, lastDualUseKey.state);
+    for(uint8_t k=key_first; k!=KEY_NONE; k=key_next[k])
+        xprintf("%02X%c", keyinfo[k].id, keyinfo[k].state == DUAL_TAPPED_NOW_HELD ? '*' : ' ');
+
+    xprintf("| DU%c", dual_replay ? 'r' : ' ');
+    for(uint8_t i=0; i<dual_queued; ++i)
+        xprintf(" %c%02X", dual_queue[i].change==KEY_PRESS ? '+' : '-', dual_queue[i].id);
+
+    xprintf(" | C%02X", combo_candidates);
+    for(uint8_t i=0; i<combo_pending; ++i)
+        xprintf(" %02X", combo_keys[i].id);
+}
+
+
+uint8_t activeKeysCount(void)
+{
+    return activeKeyCount;
+}
+
+/**
+ * A key pressed and released before a report was built would never be seen by the host,
+ * e.g. when both are replayed after a dual use decision. Its release is queued instead and
+ * replayed after the next report, like the events after a tap.
+ *
+ * @return true if the release was deferred
+ */
+static bool deferRelease(uint8_t k, const keyevent_t *ev)
+{
+    if(!keyinfo[k].fresh)
+        return false;
+
+    dual_queue[dual_queued++] = *ev;
+    dual_replay = true;
+    if(!dual_tap_reports)
+        dual_tap_reports = 1;
+    report_dirty = true;
+    return true;
+}
+
+/// Combos among the candidates that consist of exactly the held back keys.
+static uint8_t comboComplete(void)
+{
+    uint8_t complete = 0;
+    for(uint8_t i=0, m=combo_candidates; m; ++i, m>>=1) {
+        if(!(m&1))
+            continue;
+        combo_t combo = getCombo(i);
+        if(getComboSize(&combo) == combo_pending)
+            complete |= (1<<i);
+    }
+    return complete;
+}
+
+/**
+ * Stop holding back keys: add the first of the complete combos, or else
+ * press the held back keys in their original order.
+ */
+static void comboFlush(uint8_t complete, uint16_t now)
+{
+    if(complete) {
+        uint8_t idx = __builtin_ctz(complete);
+        uint8_t row = combo_keys[0].id>>4, col = combo_keys[0].id&0x0F;
+
+        trace_add(TRACE_COMBO, idx, now);
+        for(uint8_t i=0; i<combo_pending; ++i)
+            combo_held[combo_keys[i].id>>4] |= (column_size_t)1<<(combo_keys[i].id&0x0F);
+
+        addKey(row, col);
+        keypress_t *key = &keyinfo[row*COLS+col];
+        key->mode   = 0;
+        key->normal = true;
+        key->combo  = true;
+        key->action = idx;
     } else {
-        xprintf("DU   = |");
+        for(uint8_t i=0; i<combo_pending; ++i) {
+            uint8_t row = combo_keys[i].id>>4, col = combo_keys[i].id&0x0F;
+            addKey(row, col);
+            layerKeyPress(row*COLS+col);
+        }
     }
+    combo_pending = 0;
+    combo_candidates = 0;
+}
 
-    for(uint8_t i=0; i<activeKeyCount; ++i) {
-        if(activeKeys[i].id != lastDualUseKey.id)
-            xprintf("%02X ", activeKeys[i].id );
+/**
+ * Decide the held back keys once no candidate combo can be completed in time anymore.
+ * A complete combo is added right away, unless a longer one may still follow.
+ *
+ * @param now time to check the combo terms against
+ */
+static void comboResolve(uint16_t now)
+{
+    if(!combo_pending)
+        return;
+
+    uint16_t elapsed = now - combo_keys[0].time;
+    uint8_t complete = comboComplete();
+    uint8_t waiting = 0;
+
+    for(uint8_t i=0, m=combo_candidates & ~complete; m; ++i, m>>=1) {
+        if(!(m&1))
+            continue;
+        combo_t combo = getCombo(i);
+        if(elapsed < (combo.term ? combo.term : COMBO_TIMEOUT))
+            waiting |= (1<<i);
     }
+
+    combo_candidates = complete | waiting;
+    if(!waiting)
+        comboFlush(complete, now);
 }
 
+/**
+ * Hold back presses of combo keys, and consume releases of keys of matched combos.
+ *
+ * The candidates are narrowed down by the combo mask of each pressed key. Any other
+ * key event decides the held back keys first, so they are never reordered.
+ *
+ * @return true if the event was taken
+ */
+static bool comboIntake(const keyevent_t *ev)
+{
+    uint8_t row = ev->id>>4, col = ev->id&0x0F;
+    column_size_t bit = (column_size_t)1<<col;
+
+    comboResolve(ev->time);
+
+    if(ev->change==KEY_PRESS) {
+        uint8_t mask = getComboMask(row, col);
+        if(combo_pending) {
+            if((combo_candidates & mask) && combo_pending < COMBO_KEYS) {
+                combo_candidates &= mask;
+                combo_keys[combo_pending++] = *ev;
+                comboResolve(ev->time);
+                return true;
+            }
+            comboFlush(comboComplete(), ev->time);
+        }
+        if(!mask)
+            return false;
+
+        combo_candidates = mask;
+        combo_keys[combo_pending++] = *ev;
+        comboResolve(ev->time);
+        return true;
+    }
 
-uint8_t activeKeysCount(void)
+    if(combo_pending)
+        comboFlush(comboComplete(), ev->time);
+
+    if(!(combo_held[row] & bit))
+        return false;
+
+    // first released key of a combo releases it
+    uint8_t mask = getComboMask(row, col);
+    for(uint8_t k=key_first; k!=KEY_NONE; k=key_next[k]) {
+        if(keyinfo[k].combo && (mask & (1<<keyinfo[k].action))) {
+            if(deferRelease(k, ev))
+                return true;
+            delKey(keyinfo[k].row, keyinfo[k].col);
+            break;
+        }
+    }
+    combo_held[row] &= ~bit;
+    return true;
+}
+
+/// Add or remove a key from the pressed keys, pressed keys are kept in state.
+static void applyKeyEvent(const keyevent_t *ev, uint8_t state)
 {
-    return activeKeyCount;
+    uint8_t row = ev->id>>4, col = ev->id&0x0F;
+
+    if(state == DUAL_NONE && comboIntake(ev)) {
+        if((int16_t)(ev->time - dual_last_tap_time) >= 0)
+            dual_last_tap = 0xFF;
+        return;
+    }
+
+    if(ev->change==KEY_PRESS) {
+        addKey(row, col);
+        keyinfo[row*COLS+col].state = state;
+        layerKeyPress(row*COLS+col);
+    } else if(ev->change==KEY_RELEASE) {
+        if((keystate[row] & ((column_size_t)1<<col)) && deferRelease(row*COLS+col, ev))
+            return;
+        delKey(row, col);
+    }
+    // tap repeat only if the tapped key is pressed again right away,
+    // events replayed from before the tap was released do not count
+    if(state != DUAL_TAPPED_NOW_HELD && (int16_t)(ev->time - dual_last_tap_time) >= 0)
+        dual_last_tap = 0xFF;
+}
+
+/**
+ * Decide the meaning of the undecided dual use key at the head of the queue.
+ *
+ * It is tapped if released within its tapping term, and held if the term expired.
+ * Before that, another key pressed while undecided makes it hold with
+ * DUAL_HOLD_ON_OTHER_KEY, while DUAL_PERMISSIVE_HOLD requires another key to be
+ * pressed and released again. Rolling over other keys thus still yields taps.
+ *
+ * @param now time to check the tapping term against
+ * @param release set to queue index of the releasing event when tapped
+ */
+static uint8_t dualDecision(uint16_t now, uint8_t *release)
+{
+    const keyevent_t *head = &dual_queue[0];
+
+    for(uint8_t i=1; i<dual_queued; ++i) {
+        const keyevent_t *ev = &dual_queue[i];
+
+        if((uint16_t)(ev->time - head->time) >= dual_head.term)
+            return DUAL_HOLD;
+
+        if(ev->id == head->id) {
+            *release = i;
+            return DUAL_TAPPED;
+        }
+
+        if(ev->change==KEY_PRESS) {
+            if(dual_head.policy == DUAL_HOLD_ON_OTHER_KEY)
+                return DUAL_HOLD;
+        } else if(dual_head.policy == DUAL_PERMISSIVE_HOLD) {
+            for(uint8_t j=1; j<i; ++j) {
+                if(dual_queue[j].id == ev->id)
+                    return DUAL_HOLD;
+            }
+        }
+    }
+
+    if((uint16_t)(now - head->time) >= dual_head.term)
+        return DUAL_HOLD;
+
+    return DUAL_UNDECIDED;
+}
+
+/// Remove event at index from queue.
+static void dualDequeue(uint8_t idx)
+{
+    --dual_queued;
+    memmove(&dual_queue[idx], &dual_queue[idx+1], (dual_queued-idx)*sizeof(keyevent_t));
+}
+
+/**
+ * Apply a key event, or queue it if it depends on an undecided dual use key.
+ */
+static void dualIntake(const keyevent_t *event)
+{
+    keyevent_t ev = *event;
+
+    if(ev.change==KEY_HOLD)
+        return;
+
+    if(dual_queued || dual_replay || dual_tap_reports) {
+        dual_queue[dual_queued++] = ev;
+        dual_replay |= (dual_queued == 1); // tap still to be sent, keep event for later
+        return;
+    }
+
+    uint8_t row = ev.id>>4, col = ev.id&0x0F;
+    if(ev.change==KEY_PRESS && isTappingKey(row, col)) {
+        // pressed again after tap, check time for repeat
+        if(ev.id==dual_last_tap && (uint16_t)(ev.time - dual_last_tap_time) < TAP_TIMEOUT_REPEAT) {
+            applyKeyEvent(&ev, DUAL_TAPPED_NOW_HELD);
+            return;
+        }
+        dual_queue[dual_queued++] = ev;
+        dual_head = getDualUse(row, col);
+        if(dual_head.term == 0)
+            dual_head.term = TAP_TIMEOUT;
+        return;
+    }
+
+    applyKeyEvent(&ev, DUAL_NONE);
+}
+
+/**
+ * Resolve queued dual use keys as far as possible.
+ *
+ * After a tap, further events are only replayed once the tap was sent, as they
+ * happened after it. Replayed events are queued again below the read index,
+ * so the queue can be compacted in place.
+ *
+ * An undecided head is held if the queue is full.
+ *
+ * @param now time to check the tapping term of the head against
+ */
+static void dualResolve(uint16_t now)
+{
+    while(!dual_tap_reports) {
+        if(dual_replay) {
+            uint8_t n = dual_queued;
+            dual_queued = 0;
+            dual_replay = false;
+            for(uint8_t i=0; i<n; ++i)
+                dualIntake(&dual_queue[i]);
+            continue;
+        }
+        if(!dual_queued)
+            return;
+
+        uint8_t release = 0;
+        uint8_t decision = dualDecision(now, &release);
+        if(decision == DUAL_UNDECIDED) {
+            if(dual_queued < DUAL_QUEUE_SIZE)
+                return;
+            decision = DUAL_HOLD; // no room for further events
+        }
+
+        keyevent_t head = dual_queue[0];
+        trace_add(decision == DUAL_HOLD ? TRACE_DUAL_HOLD : TRACE_DUAL_TAP, head.id, now);
+        if(decision == DUAL_HOLD) {
+            applyKeyEvent(&head, DUAL_NONE);
+        } else {
+            dual_tap = getKeyCode(head.id>>4, head.id&0x0F, 0);
+            dual_tap_reports = 2;
+            report_dirty = true;
+            dual_last_tap = head.id;
+            dual_last_tap_time = dual_queue[release].time;
+            dualDequeue(release);
+        }
+        dualDequeue(0);
+        dual_replay = true;
+    }
 }
 
 /**
  *  React to any key change event emitted from scan_matrix().
  *
  *  Specified row/col key was either pressed, released or is still held.
- *  When holding occurs is determined by repeat timeout in scan_matrix().
+ *  Holding is not needed here, dual use keys are decided by their own tapping term.
+ *  Timeouts are evaluated against the time of detection passed along with the event.
  *
  *  To be able to fill a keyboard report when requested by host, we need to keep track of
  *  all keys somehow and map them to actual keycodes.
@@ -625,80 +1256,43 @@ uint8_t activeKeysCount(void)
  *  - change their meaning depending on timeouts and other keys pressed
  *  - may need to emit after having been released
  *
- *  Luckily, this handling only affects the last pressed dual use key:
- *
- *  State of the saved dual use key:
- *
- *  undecided : a new dual use key is pressed. Update save.
- *  no_tap    : if another key is pressed, or the saved key was not in tap_rep and is now held
- *  tap       : saved key in init and released within tap timeout
- *  tap_rep   : saved key in tap  and pressed again within tap_repeat timeout.
- *
- *  If the last key pressed was
+ *  A pressed dual use key is therefore queued together with all following events
+ *  until it is decided, see dualDecision(). If a tapped key is pressed again within
+ *  TAP_TIMEOUT_REPEAT, it is held as tapped key until released.
  *
+ *  Decided presses of keys that are part of a combo are held back until it is
+ *  matched or cannot be completed anymore, see comboIntake().
  */
-void keyIdChange(uint8_t row, uint8_t col, uint8_t change)
+void keyIdChange(uint8_t row, uint8_t col, uint8_t change, uint16_t time)
 {
-    static uint8_t lastDualUse __attribute__((unused));
-    static uint8_t lastPressRelease;
-    static uint32_t tapStartTime;
-    static uint32_t tapRepeatTime;
-
-    uint8_t id = (row<<4|col);
+    keyevent_t ev = { .id=(row<<4|col), .change=change, .time=time };
 
-    if(isTappingKey(row, col)) {    // change is a dual use key
-        if(change!=2) {
-            // state is set below
-            lastDualUseKey =  (keypress_t) { .row=row, .col=col, .dual=true };
-        }
-        if(change==2) { // held -> dual use is mod
-            if(lastDualUseKey.state != DUAL_TAPPED_NOW_HELD)
-                lastDualUseKey.state = DUAL_NO_TAP;
-        } else if(change==1) { // pressed again after release, check time for repeat, maybe normal
-            if(id==lastPressRelease && idle_count - tapRepeatTime < TAP_TIMEOUT_REPEAT) {
-                lastDualUseKey.state = DUAL_TAPPED_NOW_HELD;
-            } else {
-                lastDualUseKey.state = DUAL_UNDECIDED;
-            }
-            tapStartTime = idle_count; // no additional press on fast release
-        } else if(change==0) { // released again, check time for tap
-            lastDualUseKey.state = DUAL_NONE;
-            if(id==lastPressRelease && idle_count - tapStartTime < TAP_TIMEOUT) {
-                lastDualUseKey.state = DUAL_TAPPED;
-            }
-            tapRepeatTime = idle_count;
-        }
-    } else {
-        // non-dual use key changed.
-        lastDualUseKey.state = DUAL_NO_TAP;
-    };
-
-    // any key is added or removed from list - latest dual use is handled during
-    // modifier, layer or tap analysis
-    if(change==1)
-        addKey(row, col);
-    else if (change==0)
-        delKey(row, col);
+#ifdef STENO
+    // keys pressed before steno mode was entered are released regularly
+    if(steno_active() && !(change == KEY_RELEASE && (keystate[row] & ((column_size_t)1<<col)))
+       && steno_key(row, col, change))
+        return;
+#endif
 
-    // last press or release id must also be updated
-    if(change!=2) {
-        lastPressRelease = id;
-    }
+    trace_add(change, ev.id, time);
+    dualIntake(&ev);
 
     //printKeys();
 }
 
-void keyChange(uint8_t row, column_size_t p, column_size_t h, column_size_t r)
+/**
+ * Hand all key events queued by scan_matrix() to keyIdChange() in order of detection.
+ * Events are left in the matrix queue while the dual use queue is full.
+ */
+void processKeyEvents(void)
 {
-    for(uint8_t col=0; col<COLS; ++col) {
-        uint8_t mask=1<<col;
-        if(p&mask)
-            keyIdChange(row, col, 1);
-        if(h&mask)
-            keyIdChange(row, col, 2);
-        if(r&mask)
-            keyIdChange(row, col, 0);
+    keyevent_t ev;
+    while(dual_queued < DUAL_QUEUE_SIZE && matrix_pop_event(&ev)) {
+        keyIdChange(ev.id>>4, ev.id&0x0F, ev.change, ev.time);
+        dualResolve(ev.time);
     }
+    dualResolve(timer_read());
+    comboResolve(timer_read());
 }
 
 /**
@@ -707,7 +1301,7 @@ void keyChange(uint8_t row, column_size_t p, column_size_t h, column_size_t r)
   */
 bool isModifierKey(uint8_t row, uint8_t col)
 {
-    return ( MODKEY_MASK & getModifier(row,col,0));
+    return ( (MODKEY_MASK|LAYER_MASK) & getModifier(row,col,0)) == MODKEY_MASK;
 }
 
 bool isTappingKey(uint8_t row, uint8_t col)
@@ -27,16 +27,21 @@
 
 #include "config.h"
 #include "keymap.h" //column_size_t
+#ifdef NKRO
+    #include "Descriptors.h"
+#endif
 
 
-volatile uint32_t idle_count;   ///< interupt-incremented timer used for timeouts of MKT and mousekeys
-
 void      initKeyboard(void);
 
 void set_led(void);
 void set_led_color(uint8_t r, uint8_t g, uint8_t b);
+#ifdef HAS_LED
+bool led_blink(void);
+#endif
 
 uint8_t getKeyboardReport(USB_KeyboardReport_Data_t *report_data);
+void markReportDirty(void);
 
 bool suspend_wakeup_condition(void);
 void SetupHardware(void);
@@ -49,8 +54,15 @@ void initPWM(void);
 
 bool useAsMouseReport(void);
 void fillKeyboardReport(USB_KeyboardReport_Data_t * report);
+#ifdef NKRO
+uint8_t getNKROReport(USB_NKROReport_Data_t *report_data);
+#endif
 uint8_t activeKeysCount(void);
-void keyChange(uint8_t row, column_size_t p, column_size_t h, column_size_t r);
+
+#ifdef HOST
+/// Reports built by fillKeyboardReport(), counted for tools/host/check.c
+extern uint32_t host_report_builds;
+#endif
 
 // void hostLEDChange(uint8_t leds);
 
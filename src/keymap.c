@@ -19,6 +19,9 @@
 #include <avr/pgmspace.h>
 #include "keymap.h"
 #include "global_config.h"
+#ifdef KEYMAP_PACKED
+    #include "keymap_packed.h" // generated by tools/keymapc.c
+#endif
 /**
  *  Mappings of row and columns of the switch matrix to the selected layout matrix.
  *  Currently, the two halves of the keyboard are stacked so that
@@ -27,8 +30,6 @@
  *
  *  All indices are zero-based.
  */
-static keycode getKeyStruct(uint8_t row, uint8_t col, uint8_t layer);
-
 uint8_t getModifier(uint8_t row, uint8_t col, uint8_t layer)
 {
     return getKeyStruct(row, col, layer).mods;
@@ -49,8 +50,94 @@ keycode getKeyStruct(uint8_t row, uint8_t col, uint8_t layer)
 
     keycode kc;
 
+#ifdef KEYMAP_PACKED
+    if(layer == 0) {
+        memcpy_P(&kc, &KeyLayer0[row][col], sizeof(kc));
+        return kc;
+    }
+
+    keymap_row_t r;
+    memcpy_P(&r, &KeyRows[layer-1][row], sizeof(r));
+
+    column_size_t bit = (column_size_t)1<<col;
+    if(!(r.mask & bit))
+        return (keycode) { HID_NO_KEY, 0 };
+    memcpy_P(&kc, &KeyEntries[r.base + column_popcount(r.mask & (bit-1))], sizeof(kc));
+#else
     memcpy_P(&kc, &KeyMatrix[layer][row][col], sizeof(kc));
+#endif
 
     return kc;
 }
 
+#ifdef STENO
+/// Steno key at matrix position, ST__ if none.
+uint8_t getStenoKey(uint8_t row, uint8_t col)
+{
+    return pgm_read_byte(&StenoMatrix[row][col]);
+}
+#endif
+
+/**
+ * Tapping term and policy of a dual use key, term is 0 if not listed in DualUseKeys[].
+ */
+dualuse_t getDualUse(uint8_t row, uint8_t col)
+{
+    keycode kc = getKeyStruct(row, col, 0);
+    dualuse_t du;
+
+    for(uint8_t i=0; i<sizeof(DualUseKeys)/sizeof(DualUseKeys[0]); ++i) {
+        memcpy_P(&du, &DualUseKeys[i], sizeof(du));
+        if(du.kc.hid == kc.hid && du.kc.mods == kc.mods)
+            return du;
+    }
+    return (dualuse_t) { .kc=kc, .term=0, .policy=DUAL_POLICY_DEFAULT };
+}
+
+_Static_assert(COMBO_COUNT <= COMBO_MAX, "too many combos in ComboKeys[]");
+
+/**
+ * Combo from ComboKeys[], empty one if out of range.
+ */
+combo_t getCombo(uint8_t idx)
+{
+    const uint8_t count = COMBO_COUNT;
+    combo_t combo = { .term=0 };
+
+    if(idx < count)
+        memcpy_P(&combo, &ComboKeys[idx], sizeof(combo));
+    return combo;
+}
+
+/**
+ * Bitmask of combos the key at row/col is part of, found by its layer 0 entry.
+ */
+uint8_t getComboMask(uint8_t row, uint8_t col)
+{
+    const uint8_t count = COMBO_COUNT;
+    keycode kc = getKeyStruct(row, col, 0);
+    uint8_t mask = 0;
+
+    if(kc.hid == 0)
+        return 0;
+
+    for(uint8_t i=0; i<count; ++i) {
+        combo_t combo = getCombo(i);
+        for(uint8_t j=0; j<COMBO_KEYS; ++j) {
+            if(combo.keys[j].hid == kc.hid && combo.keys[j].mods == kc.mods)
+                mask |= (1<<i);
+        }
+    }
+    return mask;
+}
+
+/// Number of keys to press for a combo.
+uint8_t getComboSize(const combo_t *combo)
+{
+    uint8_t n = 0;
+    for(uint8_t j=0; j<COMBO_KEYS; ++j) {
+        if(combo->keys[j].hid != 0)
+            ++n;
+    }
+    return n;
+}
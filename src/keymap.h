@@ -50,6 +50,7 @@ typedef struct {
 } keycode;
 
 
+keycode getKeyStruct(uint8_t row, uint8_t col, uint8_t layer);
 uint8_t getModifier(uint8_t row, uint8_t col, uint8_t layer);
 uint8_t getKeyCode (uint8_t row, uint8_t col, uint8_t layer);
 //uint8_t getKeyChar (uint8_t row, uint8_t col, uint8_t layer);
@@ -62,7 +63,14 @@ uint8_t getKeyCode (uint8_t row, uint8_t col, uint8_t layer);
 #endif
 
 #define _MACRO _no
-#define LAYERS 6
+
+/// Layers in KeyMatrix below, a board or the build may set up to 16 (KB_LAYERS in makefile)
+#ifndef LAYERS
+    #define LAYERS 6
+#endif
+#if LAYERS > 16
+    #error "At most 16 layers fit into the layer stack"
+#endif
 
 // *INDENT-OFF*
 
@@ -96,7 +104,7 @@ uint8_t getKeyCode (uint8_t row, uint8_t col, uint8_t layer);
 /* 4 */  {   p,   c,   l,   m,   f,  no  }, \
 /* 5 */  {   d,   t,   r,   n,   s,  no  }, \
 /* 6 */  {   b,   g,   w,   v,   z,  no  }, \
-/* 7 */  { SHF,  M1, AGR, Uno,  M2,  M3  }  \
+/* 7 */  { SHF,  M1, AGR,Unone, M2,  M3  }  \
 }
 #endif
 
@@ -256,6 +264,65 @@ uint8_t getKeyCode (uint8_t row, uint8_t col, uint8_t layer);
 #define _DU_BSP_SHFT { HID_BACKSPACE, TAPPING_MASK | MOD_L_SHIFT }
 #define _DU_RET_MOD1 { HID_ENTER,     TAPPING_MASK | MOD_LAYER_1 }
 
+/**
+ * Tapping term and hold policy of dual use keys, found by their layer 0 entry.
+ * Terms are in ms, keys not listed use TAP_TIMEOUT and DUAL_POLICY_DEFAULT.
+ */
+enum DualUsePolicy {
+    DUAL_PERMISSIVE_HOLD,   ///< hold if another key is pressed and released while undecided
+    DUAL_HOLD_ON_OTHER_KEY, ///< hold as soon as another key is pressed
+};
+#define DUAL_POLICY_DEFAULT DUAL_PERMISSIVE_HOLD
+
+typedef struct {
+    keycode kc;
+    uint16_t term;  ///< 0 for default
+    uint8_t policy;
+} dualuse_t;
+
+dualuse_t getDualUse(uint8_t row, uint8_t col);
+
+static const dualuse_t DualUseKeys[] PROGMEM =
+{
+    // thumb keys are rolled fast, space and return in between words
+    { _DU_SPC_ALT,  300, DUAL_PERMISSIVE_HOLD   },
+    { _DU_RET_MOD1, 300, DUAL_PERMISSIVE_HOLD   },
+    // rarely tapped, mostly used as modifier
+    { _DU_TAB_CTRL, 500, DUAL_HOLD_ON_OTHER_KEY },
+};
+
+/**
+ * Combos: keys pressed together within a short window send another key instead.
+ * Keys are found by their layer 0 entry, unused ones are _no. The result is sent
+ * while all keys are held and may imply a modifier like any normal key.
+ * Term is the window [ms] from first to last press, 0 for default COMBO_TIMEOUT.
+ * Keys of a combo are held back until it is decided, so keep the window short.
+ */
+#define COMBO_KEYS 3
+#define COMBO_MAX  8 ///< candidates are tracked in an 8 bit mask
+
+typedef struct {
+    keycode keys[COMBO_KEYS];
+    keycode kc;
+    uint8_t term;   ///< 0 for default
+} combo_t;
+
+combo_t getCombo(uint8_t idx);
+uint8_t getComboMask(uint8_t row, uint8_t col);
+uint8_t getComboSize(const combo_t *combo);
+
+#ifdef HOST
+    #include "tools/host/combos.h"
+#else
+static const combo_t ComboKeys[] PROGMEM =
+{
+    // { { _j, _p, _no }, _ESC, 0 },
+    // { { _u, _q, _no }, _L_BRACKET, 0 },
+    // { { _u, _q, _PERIOD }, _L_BRACE, 60 },
+};
+#endif
+#define COMBO_COUNT (sizeof(ComboKeys)/sizeof(ComboKeys[0]))
+
 
 static const keycode KeyMatrix[LAYERS][ROWS][COLS] PROGMEM =
 {
@@ -310,17 +377,55 @@ static const keycode KeyMatrix[LAYERS][ROWS][COLS] PROGMEM =
 
 }; // end of matrix[][][]
 
+#ifdef STENO
+#include "steno.h"
+
+uint8_t getStenoKey(uint8_t row, uint8_t col);
+
+/**
+ * Steno keys in steno mode, on the home and upper row with vowels on the inner thumbs.
+ * Bottom row and remaining thumb keys keep their regular meaning, e.g. to reach command mode.
+ */
+static const uint8_t StenoMatrix[ROWS][COLS] PROGMEM =
+  KEYMAP( ST__,
+    ST_N1, ST_S1, ST_TL, ST_PL, ST_HL, ST_ST1,   ST_FR, ST_PR, ST_LR, ST_TR, ST_DR, ST_ST3,
+    ST_N2, ST_S2, ST_KL, ST_WL, ST_RL, ST_ST2,   ST_RR, ST_BR, ST_GR, ST_SR, ST_ZR, ST_ST4,
+    ST__,  ST__,  ST__,  ST__,  ST__,  ST__,     ST__,  ST__,  ST__,  ST__,  ST__,  ST__,
+    ST__,  ST__,  ST__,  ST_N3, ST_A,  ST_O,     ST_E,  ST_U,  ST__,  ST_N4, ST__,  ST__
+  );
+#endif
+
 // *INDENT-OFF*
 
+// Key ids limit COLS to 16, see matrix.h
 #if   (COLS <= 8)
     typedef uint8_t  column_size_t;
 #elif (COLS <= 16)
     typedef uint16_t column_size_t;
-#elif (COLS <= 32)
-    typedef uint32_t column_size_t;
 #else
-    #error "More than 32 columns are not supported"
+    #error "More than 16 columns are not supported"
 #endif
 
+// *INDENT-ON*
 
+/// Index of lowest set bit, c must not be 0.
+static inline uint8_t column_ffs(column_size_t c)
+{
+    return __builtin_ctz(c);
+}
+
+/// Number of set bits.
+static inline uint8_t column_popcount(column_size_t c)
+{
+    return __builtin_popcount(c);
+}
+
+/**
+ * Packed keymap (KEYMAP_PACKED): a row of a layer above 0 holds only its defined keys,
+ * in column order from index base of KeyEntries[], see tools/keymapc.c.
+ */
+typedef struct {
+    uint8_t       base;  ///< index of first key in KeyEntries[]
+    column_size_t mask;  ///< columns with a key, others are _no
+} keymap_row_t;
 
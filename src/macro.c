@@ -20,113 +20,91 @@
 /**
  * @TODO:
  *   - clear up convoluted mess of string assembly in command.c
- *   - interface for dynamic lengths of different macros
- *   - usability: signal remaining free slots, used characters, ...
  */
 
 
 #include "macro.h"
+#include "macro_heap.h"
 #include "helpers.h"
 #include "Keyboard.h"
 #include "ascii2hid.h"
+#include "timer.h"
 
 #include "global_config.h"
 
-#define MACRO_ID_INVALID 255     // 255 means no recording is going on.
 #define MACRO_INVALID    255     // can be used by anyone here
-#define MACRO_COMPLETE   254     // outstring has been written to completely and can be printed
+#define MACRO_COMPLETE   254     // output has been set completely and can be printed
+#define MACRO_END        0x8000  // read offset after the end of any output
 
-static uint8_t sendEmpty;    // empty report needed to send the same character twice in a row
+/// Holds selector character of macro while recording, 0 if no recording is going on.
+static char g_macrorecord=0;
 
-/// Holds index of macro while recording, 0<=idx<MACROCOUNT.
-static uint8_t g_macrorecord=MACRO_ID_INVALID;
-
-/// cur offset in outHidCodes, both read & write for macro
+/// write offset while recording a macro, otherwise MACRO_INVALID or MACRO_COMPLETE
 static uint8_t outOffs = MACRO_INVALID;
 
-/// Buffer for EEPROM macros and strings to print out
-static uint8_t outHidCodes[MACRO_MAX_LEN+1];
+/// Maximum length of the macro being recorded, see macro_heap_begin().
+static uint8_t recLimit;
 
-static inline void disableMacroRecording(void) { g_macrorecord=MACRO_ID_INVALID; setCommandMode(false); outOffs=MACRO_INVALID; };
+/// Macro to print from EEPROM, or MACRO_HEAP_NONE to print outString.
+static uint16_t outRec = MACRO_HEAP_NONE;
+static uint8_t  outLen;
 
-bool appendHidCode(uint8_t hid);
-bool clearHIDCodes(void);
-uint8_t findMacroId(char macro_char);
-uint8_t findFreeMacroId(void);
-void print_used_macro_chars(void);
+/// String to print, converted to HID codes while printing.
+static char outString[MACRO_STR_LEN+1];
 
+/// Next few HID codes to print, from offset windowOffs on.
+static uint8_t  outWindow[MACRO_WINDOW];
+static uint16_t windowOffs;
 
+/// Offset and duration of the last recorded pause, to extend it.
+static uint8_t delayOffs = MACRO_INVALID;
+static uint8_t delayTime;
 
-/**
- * Find macro id for given character.
- *
- * @return id, or MACRO_ID_INVALID if not found.
- */
-uint8_t findMacroId(char macro_char)
-{
-    uint8_t offs;
-    for(offs=0; offs<MACROCOUNT; ++offs) {
-        if(macro_char == eeprom_read_byte (( const void *) (EE_ADDR_MACRO_MAP + offs)) ) {
-            return offs;
-        }
-    }
-    // not found
-    return MACRO_ID_INVALID;
-}
+/// Playback waits for a pause, cleared by timed event.
+static bool paused;
+static void macroResume(void) { paused=false; }
 
-/**
- * Return index of first non-alnum macro character in map,
- * or MACRO_ID_INVALID if all slots are in use.
- */
-uint8_t findFreeMacroId()
-{
-    char macro_char;
-    uint8_t offs;
-    for(offs=0; offs<MACROCOUNT; ++offs) {
-        macro_char = eeprom_read_byte (( const void *) (EE_ADDR_MACRO_MAP + offs));
-        if(! isalnum(macro_char)) {
-            return offs;
-        }
-    }
-    // not found
-    return MACRO_ID_INVALID;
-}
+static inline void disableMacroRecording(void) { g_macrorecord=0; setCommandMode(false); outOffs=MACRO_INVALID; };
+
+bool appendHidCode(uint8_t hid);
+void print_used_macro_chars(void);
 
+
+
+/// Print selectors of all macros and the length of the longest one that still fits.
 void print_used_macro_chars()
 {
-    uint8_t offs;
-    char macro_char __attribute__((unused));
+    uint8_t it=0;
+    char macro_char;
     xprintf("\nM:");
-    for(offs=0; offs<MACROCOUNT; ++offs) {
-        macro_char = eeprom_read_byte (( const void *) (EE_ADDR_MACRO_MAP + offs));
-        xprintf("%c ", isalnum(macro_char) ? macro_char : '-');
-    }
+    while((macro_char = macro_heap_next(&it)) != 0)
+        xprintf("%c ", macro_char);
+    xprintf("free %d", macro_heap_free());
 }
 
 /**
- * Update macro for character c, or create a new one in free slot.
- * Free slot is indicated with map entry of index = MACRO_INVALID.
- *
+ * Start recording macro for character c, replacing an existing one when saved,
+ * or record next key while recording.
  */
 bool setMacroRecording(char macro_char, uint8_t hid, uint8_t mod)
 {
-    if(g_macrorecord >= MACROCOUNT) { // first call, new macro
+    if(g_macrorecord == 0) { // first call, new macro
         if(!isalnum(macro_char)) // do not store what cannot be retrieved :-)
             goto err;
 
-        uint8_t offs = MACRO_ID_INVALID;
-
-        offs = findMacroId(macro_char); // first check if macro_char is already in use
-        if(offs == MACRO_ID_INVALID)
-            offs = findFreeMacroId(); // find empty spot
+        if(outOffs == MACRO_INVALID) {
+            recLimit = macro_heap_begin();
+            if(recLimit == 0) { // no space left
+                print_used_macro_chars();
+                goto err;
+            }
+            if(recLimit >= MACRO_COMPLETE)
+                recLimit = MACRO_COMPLETE-1;
 
-        if(offs != MACRO_ID_INVALID && clearHIDCodes()) {
-            g_macrorecord=offs;
-            outHidCodes[0]=macro_char;
-            outOffs=1;
+            g_macrorecord=macro_char;
+            outOffs=0;
+            delayOffs=MACRO_INVALID;
             return true;
-        } else { // no free slot found
-            print_used_macro_chars();
         }
     } else { // next macro character
         macro_key(hid,mod);
@@ -134,19 +112,20 @@ bool setMacroRecording(char macro_char, uint8_t hid, uint8_t mod)
     }
 
 err:
-    g_macrorecord = MACRO_ID_INVALID;
+    g_macrorecord = 0;
     return false;
 };
 
 /**
- * @brief appendHidCode Append given hid code / modifier to buffer
- * @param hid HID code or (modifier|0x80) or 0 to end.
+ * @brief appendHidCode Append given hid code / modifier to macro being recorded
+ * @param hid HID code or (modifier|0x80) or delay
  * @return true if successful
  */
 bool appendHidCode(uint8_t hid)
 {
-    if(outOffs<MACRO_MAX_LEN) {
-        outHidCodes[outOffs] = hid;
+    if(outOffs<recLimit) {
+        decrypt_at(&hid, 1, outOffs); // xor with unlock code, same as encrypt
+        macro_heap_put(outOffs, hid);
         ++outOffs;
         return true;
     }
@@ -154,24 +133,12 @@ bool appendHidCode(uint8_t hid)
 }
 
 
-bool clearHIDCodes()
-{
-    if(outOffs != MACRO_INVALID)
-        return false;
-
-    memset(outHidCodes,0,MACRO_MAX_LEN+1);
-    outOffs=0;
-    return true;
-}
-
-
-/** Record key into macro:
- *    Up to MACRO_MAX_LEN keys may be stored, but any combination of modifiers takes one additional slot.
- *    @todo: Dynamic length, macro idx
+/** Record key into macro, written to eeprom directly:
+ *    Up to macro_heap_free() keys may be stored, but any combination of modifiers takes one additional slot.
  *
  *    Ctrl+Enter terminates macro entry
  *    Ctrl+Esc   aborts
- *    Alt+Enter  inserts pause
+ *    Alt+Enter  inserts pause of 400ms, repeated directly extends it up to 2.5s
  */
 void macro_key(uint8_t hid, uint8_t mod)
 {
@@ -181,14 +148,25 @@ void macro_key(uint8_t hid, uint8_t mod)
     }
     // Ctrl+Enter ends macro recording
     if(hid == HID_ENTER && mod == HID_MOD_MASK(MOD_L_CTRL)) {
-        if( appendHidCode(0) ) {
-            uint8_t written __attribute__((unused));
-            written=updateEEMacroHID(outHidCodes, g_macrorecord);
-        }
+        if(outOffs == 0) // nothing recorded
+            macro_heap_delete(g_macrorecord);
+        else if(!macro_heap_commit(g_macrorecord, outOffs))
+            print_used_macro_chars();
 
         disableMacroRecording();
         return;
     }
+    if(hid == HID_ENTER && mod == HID_MOD_MASK(MOD_L_ALT)) {
+        if(delayOffs == outOffs-1 && delayTime <= 255-MACRO_DELAY_DEFAULT) {
+            delayTime += MACRO_DELAY_DEFAULT;
+            --outOffs;
+            appendHidCode(delayTime);
+        } else if(appendHidCode(MACRO_DELAY) && appendHidCode(MACRO_DELAY_DEFAULT)) {
+            delayOffs = outOffs-1;
+            delayTime = MACRO_DELAY_DEFAULT;
+        }
+        return;
+    }
 
     if(mod != 0)
         appendHidCode(mod|0x80);
@@ -197,124 +175,84 @@ void macro_key(uint8_t hid, uint8_t mod)
 
 }
 
-/// shortcut to put macro directly in print buffer
+/// Start printing macro for given character, returns its length or 0 if there is none.
 uint8_t printMacro(char macro_char)
 {
-    uint8_t ret=0;
+    uint8_t len=0;
     if(outOffs==MACRO_INVALID) { // Ready to read, not in use
-        uint8_t macro_idx = MACRO_ID_INVALID;
-        macro_idx=findMacroId(macro_char);
-        if(macro_idx != MACRO_INVALID) {
-            ret=readEEMacroHID(outHidCodes, macro_idx);
+        outRec=macro_heap_find(macro_char, &len);
+        if(outRec != MACRO_HEAP_NONE) {
+            outLen=len;
+            windowOffs=MACRO_END;
             outOffs=MACRO_COMPLETE;
         } else {
+            len=0;
             print_used_macro_chars();
         }
     }
-    return ret;
+    return len;
 }
 
 /**
- * Reads the macro at given index from eeprom into macro and returns its length.
- * Caller needs to make sure there is enough space allocated!
+ * Will copy given string of up to MACRO_STR_LEN characters to be printed.
+ * It is then delivered by the call to printOutStr() in keyboards main loop.
  */
-uint8_t readEEMacroHID(uint8_t * macro, uint8_t idx)
+uint8_t setOutputString(char * str)
 {
-    if(idx>=MACROCOUNT)
+    if(outOffs != MACRO_INVALID)
         return 0;
 
-    eeprom_busy_wait();
-    uint8_t len=eeprom_read_byte (( const void *) EE_ADDR_MACRO(idx) );
-
-    if(len>MACRO_MAX_LEN)
-        len=MACRO_MAX_LEN;
-
-    eeprom_busy_wait();
-    eeprom_read_block (( void *) macro, ( const void *) (EE_ADDR_MACRO(idx)+1), len);
-
-    macro[len]=0;
-
-    // xor with unlock code
-    decrypt(macro,len);
-
-    return len;
-}
-
+    strncpy(outString, str, MACRO_STR_LEN);
+    outString[MACRO_STR_LEN]='\0';
+    outRec=MACRO_HEAP_NONE;
+    windowOffs=MACRO_END;
+    outOffs = MACRO_COMPLETE;
+    return 1;
+};
 
 /**
- * Writes the macro to eeprom at given index and returns length of written string.
- * If macro[0] is 0 then clear its access character from map to free it.
+ * HID code at offs of the macro or string being printed, 0 after its end.
  *
- * As eeprom update functions are used, no unnecessary writes are performed.
- *
- * @param macro array of hid/modifier codes to store, '0' signals end of macro
- *              first character is macro selector character
- * @param idx   index of macro to store
+ * Codes are fetched MACRO_WINDOW at a time: macros are read from eeprom and
+ * decrypted, strings converted from ASCII.
  */
-uint8_t updateEEMacroHID(uint8_t * macro, uint8_t idx)
+static uint8_t outCode(uint16_t offs)
 {
-    if(idx>=MACROCOUNT)
-        return 0;
-
-    if(macro[1] == 0) { // clear macro - [0] contains selector character.
-        eeprom_busy_wait();
-        eeprom_update_byte ((void *) (EE_ADDR_MACRO_MAP + idx), MACRO_ID_INVALID);
-        return 0;
-    }
-
-    uint8_t len=0;
-    while(macro[len] != 0 && len < MACRO_MAX_LEN) {
-        ++len;
+    if(offs < windowOffs || offs >= windowOffs+MACRO_WINDOW) {
+        memset(outWindow, 0, MACRO_WINDOW);
+        windowOffs = offs;
+
+        if(outRec != MACRO_HEAP_NONE) {
+            if(offs < outLen) {
+                uint8_t n = outLen-offs < MACRO_WINDOW ? outLen-offs : MACRO_WINDOW;
+                macro_heap_read(outRec, offs, outWindow, n);
+                // xor with unlock code
+                decrypt_at(outWindow, n, offs);
+            }
+        } else {
+            uint16_t pos=0;
+            uint8_t hid, mod;
+            // convert each char to HID codes
+            for(uint8_t i=0; outString[i] != '\0' && pos < offs+MACRO_WINDOW; ++i) {
+                ascii2hid(outString[i], &hid, &mod);
+                uint8_t code[2] = { mod|0x80, hid };
+                for(uint8_t k = mod ? 0 : 1; k<2; ++k) {
+                    if(code[k] != 0 && pos++ >= offs && pos <= offs+MACRO_WINDOW)
+                        outWindow[pos-1-offs] = code[k];
+                }
+            }
+        }
     }
-    // xor with unlock code, macro[0] contains selector character so ignore that one
-    encrypt(&macro[1], len-1);
-
-    eeprom_busy_wait();
-    eeprom_update_byte ((void *) (EE_ADDR_MACRO_MAP + idx), macro[0]);
-
-    eeprom_busy_wait();
-    eeprom_update_byte ((void *) EE_ADDR_MACRO(idx), len-1 );
-
-    eeprom_busy_wait();
-    eeprom_update_block (( const void *) (&macro[1]), (void *) (EE_ADDR_MACRO(idx)+1), len-1 );
-
-    return len;
+    return outWindow[offs-windowOffs];
 }
 
 
 /**
- * Will copy given string to output buffer.
- * It is then delivered by the call to printOutStr() in keyboards main loop.
- */
-uint8_t setOutputString(char * str)
-{
-    if (! clearHIDCodes() )
-        return 0;
-
-    uint8_t i, ch, hid, mod;
-    // convert each char to HID codes
-    for(i=0; str[i] != '\0'; ++i) {
-        ch=str[i];
-        ascii2hid(ch, &hid, &mod);
-        //hid=ascii2hid[ch][0];
-        //mod=HID_MOD_MASK(ascii2hid[ch][1]);
-
-        if(mod != 0)
-            appendHidCode(mod|0x80);
-        if(hid != 0)
-            appendHidCode(hid);
-    }
-
-    outOffs = MACRO_COMPLETE;
-    return 1;
-};
-
-
-/**
- * Fills report with one characters from outHidCodes[] until all done.
- *
- * @todo : could send up to 6 if no modifiers, but not worth the extra checks.
+ * Fills report with the next keys from the macro or string until all done.
  *
+ * Up to six consecutive keys with the same modifier go into one report, which the
+ * host types in report order. A release report is only inserted before a key that
+ * is still pressed from the previous report, or before the modifier changes.
  */
 uint8_t printOutstr(USB_KeyboardReport_Data_t * report)
 {
@@ -322,49 +260,72 @@ uint8_t printOutstr(USB_KeyboardReport_Data_t * report)
     if(outOffs!=MACRO_COMPLETE)
         return 0;
 
-    static uint8_t readOffs = 0;
-
-    if( sendEmpty) {
-        memset(&report->KeyCode[0], 0, 6);
-        sendEmpty = sendEmpty ? 0 : 1;
-        return 1;
-    }
+    static uint16_t readOffs = 0;
+    static uint8_t lastKeys[6];  // keys of the previous report
+    static uint8_t lastMod;
 
-    uint8_t mod=0;
-    if( readOffs<MACRO_MAX_LEN) {
-        uint8_t c = outHidCodes[readOffs++];
+    uint8_t idx=0, mod=0;
+    while( !paused && idx<6) {
+        uint16_t offs = readOffs;
+        uint8_t c = outCode(offs++);
+        uint8_t m = 0;
+        uint8_t delay = 0;
         if(c == 0)
-            goto all_printed;
-
-        // can handle extra modifiers here like in getMacroReport()
-        // if > 127, it is a modifier
-        if( (c&0x80) && readOffs<MACRO_MAX_LEN) {
-            mod=(c&0x7F);
-            c = outHidCodes[readOffs++];
-            // assert c != mod here?
-            if( mod==HID_MOD_MASK(MOD_L_ALT) && c==HID_ENTER) {
-                _delay_ms(400);
-                c=0; mod=0;
+            break;
+
+        if(c == MACRO_DELAY) {
+            delay = outCode(offs++);
+            if(delay == 0) {
+                readOffs = MACRO_END;
+                break;
             }
+        } else if(c&0x80) { // if > 127, it is a modifier
+            m = (c&0x7F);
+            c = outCode(offs++);
+            if( m==HID_MOD_MASK(MOD_L_ALT) && c==HID_ENTER)
+                delay = MACRO_DELAY_DEFAULT;
         }
-        // @TODO Should check complete macro before it is entered into buffer.
-        if(c > HID_F24)
-            goto all_printed;
-
-        // now fill in one character
-        /// @todo Is this necessary - purge zeroReport() ???
-        memset(&report->KeyCode[0],0,6);
-        report->KeyCode[0]=c;
-        report->Modifier  =mod;
-        sendEmpty = sendEmpty ? 0 : 1;
-        return 1;
+        if(delay) {
+            if(idx > 0 || lastKeys[0])
+                break; // pause with all keys released
+            readOffs = offs;
+            paused = timer_schedule(delay*MACRO_DELAY_UNIT, macroResume);
+            continue;
+        }
+        // @TODO Should check complete macro before it is printed.
+        if(c == 0 || c > HID_F24) {
+            readOffs = MACRO_END;
+            break;
+        }
+
+        if(idx == 0) {
+            if(lastKeys[0] && m != lastMod)
+                break;
+            mod = m;
+        } else if(m != mod || memchr(report->KeyCode, c, idx)) {
+            break;
+        }
+        if(memchr(lastKeys, c, sizeof(lastKeys)))
+            break;
+
+        report->KeyCode[idx++] = c;
+        readOffs = offs;
     }
 
-all_printed:
+    bool released = (lastKeys[0] == 0);
+
+    memset(&report->KeyCode[idx], 0, 6-idx);
+    report->Modifier = mod;
+    memcpy(lastKeys, report->KeyCode, sizeof(lastKeys));
+    lastMod = mod;
+
+    if(idx || !released || paused)
+        return 1;
+
     // getting here means we're done, so invalidate for next run
     outOffs=MACRO_INVALID;
+    outRec=MACRO_HEAP_NONE;
     readOffs=0;
     return 0;
 }
 
-
@@ -28,16 +28,25 @@
 #include "command.h"
 
 /**
- *  Macros are stored in eeprom. To avoid excessive rewrites, a fixed maximum length is set.
- *  Addresses are fixed.
+ *  Macros are stored in the eeprom macro heap with variable length, see macro_heap.h.
+ *  They are recorded directly into eeprom and played from there, only MACRO_WINDOW
+ *  codes at a time are held in RAM. Strings to print are limited to MACRO_STR_LEN.
  *  .
  *  @todo Enable pre-loading under certain conditions via *.eep like with _private_macros.c previously?
 */
-#define MACROCOUNT       12
-#define MACRO_MAX_LEN    40
+#define MACRO_WINDOW     8
+#define MACRO_STR_LEN    27
+
+/**
+ * Stored macros are sequences of HID codes, each optionally preceded by (modifier|0x80).
+ * A pause is MACRO_DELAY followed by its duration in units of MACRO_DELAY_UNIT ms (1..255),
+ * which is free as it would be an empty modifier. The former fixed pause Alt+Return
+ * is still played as MACRO_DELAY_DEFAULT.
+ */
+#define MACRO_DELAY         0x80
+#define MACRO_DELAY_UNIT    10
+#define MACRO_DELAY_DEFAULT (400/MACRO_DELAY_UNIT)
 
-uint8_t updateEEMacroHID(uint8_t macro[MACRO_MAX_LEN], uint8_t idx);
-uint8_t readEEMacroHID  (uint8_t macro[MACRO_MAX_LEN], uint8_t idx);
 /// shortcut to put macro directly in print buffer
 uint8_t printMacro(char macro_char);
 
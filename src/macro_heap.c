@@ -0,0 +1,430 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "macro_heap.h"
+#include "global_config.h"
+
+#define REC_FREE     0xFF   ///< erased, marks the head
+#define REC_DELETED  0x00
+#define REC_VALID    0x4D
+
+#define HEAP_SIZE    EE_MACRO_HEAP_SIZE
+
+/// Tail position slot in EEPROM, the valid one with the later seq is used.
+typedef struct {
+    uint8_t  seq;
+    uint16_t pos;
+    uint8_t  crc;
+} __attribute__((packed)) tail_slot_t;
+
+/// Latest record of each selector, MACRO_HEAP_NONE if there is none.
+typedef struct {
+    uint16_t rec;
+    uint8_t  len;
+} __attribute__((packed)) heap_index_t;
+
+static uint16_t heap_tail;  ///< oldest record
+static uint16_t heap_head;  ///< next record, always REC_FREE
+static uint8_t  tail_seq;   ///< seq of the slot holding heap_tail
+static uint16_t heap_live;  ///< bytes of all records in heap_index
+
+/// Built by macro_heap_init(), so lookups need no EEPROM access.
+static heap_index_t heap_index[MACRO_HEAP_SELECTORS];
+
+
+/// Index of selector 0-9, a-z, A-Z in heap_index[], or -1.
+static int8_t sel_index(char sel)
+{
+    if('0' <= sel && sel <= '9')
+        return sel - '0';
+    if('a' <= sel && sel <= 'z')
+        return sel - 'a' + 10;
+    if('A' <= sel && sel <= 'Z')
+        return sel - 'A' + 36;
+    return -1;
+}
+
+static void index_set(int8_t i, uint16_t rec, uint8_t len)
+{
+    if(heap_index[i].rec != MACRO_HEAP_NONE)
+        heap_live -= MACRO_HEAP_HDR + heap_index[i].len;
+    if(rec != MACRO_HEAP_NONE)
+        heap_live += MACRO_HEAP_HDR + len;
+    heap_index[i] = (heap_index_t) { .rec = rec, .len = len };
+}
+
+static void index_clear(void)
+{
+    for(uint8_t i=0; i<MACRO_HEAP_SELECTORS; ++i)
+        heap_index[i].rec = MACRO_HEAP_NONE;
+    heap_live = 0;
+}
+
+static inline uint16_t wrap(uint16_t pos)
+{
+    return pos >= HEAP_SIZE ? pos - HEAP_SIZE : pos;
+}
+
+static uint8_t heap_read_byte(uint16_t pos)
+{
+    eeprom_busy_wait();
+    return eeprom_read_byte((const uint8_t *) (EE_ADDR_MACRO_HEAP + wrap(pos)));
+}
+
+static void heap_write_byte(uint16_t pos, uint8_t value)
+{
+    eeprom_busy_wait();
+    eeprom_update_byte((uint8_t *) (EE_ADDR_MACRO_HEAP + wrap(pos)), value);
+}
+
+static uint8_t tail_crc(const tail_slot_t *slot)
+{
+    uint8_t crc = _crc8_ccitt_update(0, slot->seq);
+    crc = _crc8_ccitt_update(crc, slot->pos & 0xFF);
+    return _crc8_ccitt_update(crc, slot->pos >> 8);
+}
+
+static bool read_tail_slot(uint8_t i, tail_slot_t *slot)
+{
+    eeprom_busy_wait();
+    eeprom_read_block(slot, (const void *) (EE_ADDR_MACRO_TAIL + i*sizeof(tail_slot_t)), sizeof(tail_slot_t));
+    return slot->pos < HEAP_SIZE && slot->crc == tail_crc(slot);
+}
+
+/// Store tail in the slot not holding the current one.
+static void set_tail(uint16_t pos)
+{
+    tail_slot_t slot = { .seq = tail_seq+1, .pos = pos };
+    slot.crc = tail_crc(&slot);
+
+    eeprom_busy_wait();
+    eeprom_update_block(&slot, (void *) (EE_ADDR_MACRO_TAIL + (slot.seq&1)*sizeof(tail_slot_t)), sizeof(tail_slot_t));
+    tail_seq  = slot.seq;
+    heap_tail = pos;
+}
+
+static inline uint16_t used(void)
+{
+    return heap_head >= heap_tail ? heap_head - heap_tail : HEAP_SIZE - heap_tail + heap_head;
+}
+
+static inline uint16_t rec_size(uint16_t rec)
+{
+    return MACRO_HEAP_HDR + heap_read_byte(rec+2);
+}
+
+/// crc of a record with its data in EEPROM at pos.
+static uint8_t data_crc(char sel, uint8_t len, uint16_t pos)
+{
+    uint8_t crc = _crc8_ccitt_update(0, sel);
+    crc = _crc8_ccitt_update(crc, len);
+    for(uint8_t i=0; i<len; ++i)
+        crc = _crc8_ccitt_update(crc, heap_read_byte(pos+i));
+    return crc;
+}
+
+static inline uint8_t rec_crc(uint16_t rec)
+{
+    return data_crc(heap_read_byte(rec+1), heap_read_byte(rec+2), rec+MACRO_HEAP_HDR);
+}
+
+/**
+ * Append a record at the head with its data already written by macro_heap_put().
+ * Caller must make sure there is space for it and the REC_FREE after.
+ * @return position of the record
+ */
+static uint16_t append(char sel, uint8_t len, uint8_t crc)
+{
+    uint16_t rec = heap_head;
+
+    heap_write_byte(rec+1, sel);
+    heap_write_byte(rec+2, len);
+    heap_write_byte(rec+3, crc);
+
+    heap_head = wrap(rec + MACRO_HEAP_HDR + len);
+    heap_write_byte(heap_head, REC_FREE);
+    heap_write_byte(rec, REC_VALID); // commit
+    return rec;
+}
+
+/**
+ * Compact from the tail until free space exceeds size plus reserve.
+ * @return false if the live records do not leave that much space.
+ */
+static bool collect(uint16_t size, uint16_t reserve)
+{
+    if(heap_live + size + reserve >= HEAP_SIZE)
+        return false;
+
+    while(HEAP_SIZE - used() <= size + reserve) {
+        uint16_t rec = heap_tail;
+        if(heap_read_byte(rec) == REC_VALID) {
+            if(HEAP_SIZE - used() <= rec_size(rec))
+                return false; // reserve lost, should not happen
+            char    sel = heap_read_byte(rec+1);
+            uint8_t len = heap_read_byte(rec+2);
+            for(uint8_t i=0; i<len; ++i)
+                macro_heap_put(i, heap_read_byte(rec+MACRO_HEAP_HDR+i));
+            index_set(sel_index(sel), append(sel, len, heap_read_byte(rec+3)), len);
+            heap_write_byte(rec, REC_DELETED);
+        }
+        set_tail(wrap(rec + rec_size(rec)));
+    }
+    return true;
+}
+
+/**
+ * Erase all macros.
+ */
+void macro_heap_format(void)
+{
+    index_clear();
+    tail_seq = 0;
+    heap_head = 0;
+    heap_write_byte(0, REC_FREE);
+    set_tail(0);
+    set_tail(0); // both slots valid
+}
+
+/// Former fixed macro slots: a map of selectors, then a length byte and data each.
+#define OLD_MACROS       12
+#define OLD_MACRO_LEN    40
+#define OLD_ADDR_SLOT(i) (EE_ADDR_START + OLD_MACROS + (i)*(OLD_MACRO_LEN+1))
+
+#if HEAP_SIZE <= OLD_MACROS*(MACRO_HEAP_HDR+OLD_MACRO_LEN)
+#error "Macro heap too small to import the former macro slots"
+#endif
+
+/**
+ * Import the macros of the former fixed slots into an empty heap starting after
+ * them. Records are larger than slots, so later ones may wrap around into slots,
+ * but only into those already read. The map is read first as the tail slots cover
+ * it. A power loss keeps the macros imported so far.
+ * @return false if there were none.
+ */
+static bool import_slots(void)
+{
+    char map[OLD_MACROS];
+    bool found = false;
+
+    eeprom_busy_wait();
+    eeprom_read_block(map, (const void *) EE_ADDR_START, OLD_MACROS);
+    for(uint8_t idx=0; idx<OLD_MACROS; ++idx) {
+        if(sel_index(map[idx]) >= 0)
+            found = true;
+    }
+    if(!found)
+        return false;
+
+    index_clear();
+    tail_seq = 0;
+    heap_head = OLD_ADDR_SLOT(OLD_MACROS) - EE_ADDR_MACRO_HEAP;
+    heap_write_byte(heap_head, REC_FREE);
+    set_tail(heap_head);
+    set_tail(heap_head); // both slots valid
+
+    for(uint8_t idx=0; idx<OLD_MACROS; ++idx) {
+        int8_t  i   = sel_index(map[idx]);
+        eeprom_busy_wait();
+        uint8_t len = eeprom_read_byte((const uint8_t *) OLD_ADDR_SLOT(idx));
+        if(i < 0 || heap_index[i].rec != MACRO_HEAP_NONE || len == 0 || len > OLD_MACRO_LEN)
+            continue; // free, shadowed by an earlier slot, or broken
+
+        for(uint8_t j=0; j<len; ++j) {
+            eeprom_busy_wait();
+            macro_heap_put(j, eeprom_read_byte((const uint8_t *) (OLD_ADDR_SLOT(idx)+1+j)));
+        }
+        macro_heap_commit(map[idx], len);
+    }
+    return true;
+}
+
+/**
+ * Load tail position, find the head and build the index of all macros. Records cut
+ * by a power loss or failing their crc are deleted, as are older versions of a macro
+ * left from an update. Without a valid tail the macros of the former fixed slots
+ * are imported, if there are none the heap is formatted.
+ */
+void macro_heap_init(void)
+{
+    tail_slot_t a, b;
+    bool va = read_tail_slot(0, &a);
+    bool vb = read_tail_slot(1, &b);
+
+    if(!va && !vb) {
+        if(!import_slots())
+            macro_heap_format();
+        return;
+    }
+    if(!va || (vb && (int8_t)(b.seq - a.seq) > 0))
+        a = b;
+    heap_tail = a.pos;
+    tail_seq  = a.seq;
+    index_clear();
+
+    uint16_t rec = heap_tail, n = 0;
+    for(;;) {
+        uint8_t status = heap_read_byte(rec);
+        if(status != REC_VALID && status != REC_DELETED)
+            break;
+        uint16_t size = rec_size(rec);
+        if(n + size >= HEAP_SIZE)
+            break;
+        if(status == REC_VALID) {
+            int8_t i = sel_index(heap_read_byte(rec+1));
+            if(i < 0 || rec_crc(rec) != heap_read_byte(rec+3)) {
+                heap_write_byte(rec, REC_DELETED);
+            } else {
+                if(heap_index[i].rec != MACRO_HEAP_NONE)
+                    heap_write_byte(heap_index[i].rec, REC_DELETED); // later one wins
+                index_set(i, rec, size - MACRO_HEAP_HDR);
+            }
+        }
+        n  += size;
+        rec = wrap(rec + size);
+    }
+    heap_head = rec;
+    heap_write_byte(heap_head, REC_FREE);
+}
+
+/**
+ * Iterate selectors of all macros, start with *it = 0.
+ * @return selector, or 0 at the end.
+ */
+char macro_heap_next(uint8_t *it)
+{
+    while(*it < MACRO_HEAP_SELECTORS) {
+        uint8_t i = (*it)++;
+        if(heap_index[i].rec != MACRO_HEAP_NONE)
+            return i < 10 ? '0'+i : (i < 36 ? 'a'+i-10 : 'A'+i-36);
+    }
+    return 0;
+}
+
+/**
+ * Find macro sel in the index.
+ * @return record position and its data length in *len, or MACRO_HEAP_NONE.
+ */
+uint16_t macro_heap_find(char sel, uint8_t *len)
+{
+    int8_t i = sel_index(sel);
+    if(i < 0)
+        return MACRO_HEAP_NONE;
+    *len = heap_index[i].len;
+    return heap_index[i].rec;
+}
+
+/// Read n data bytes of record rec starting at offs.
+void macro_heap_read(uint16_t rec, uint8_t offs, uint8_t *dst, uint8_t n)
+{
+    uint16_t pos = wrap(rec + MACRO_HEAP_HDR + offs);
+    uint16_t end = HEAP_SIZE - pos; // bytes before wrap-around
+    if(end > n)
+        end = n;
+
+    eeprom_busy_wait();
+    eeprom_read_block(dst, (const void *) (EE_ADDR_MACRO_HEAP + pos), end);
+    eeprom_read_block(dst+end, (const void *) EE_ADDR_MACRO_HEAP, n-end);
+}
+
+/// Size of the largest record, at least size.
+static uint16_t largest(uint16_t size)
+{
+    for(uint8_t i=0; i<MACRO_HEAP_SELECTORS; ++i) {
+        if(heap_index[i].rec != MACRO_HEAP_NONE && MACRO_HEAP_HDR + heap_index[i].len > size)
+            size = MACRO_HEAP_HDR + heap_index[i].len;
+    }
+    return size;
+}
+
+/**
+ * Make room for a new macro of up to the returned length, to be written with
+ * macro_heap_put() and stored with macro_heap_commit(). Nothing is stored if
+ * it is not committed.
+ */
+uint8_t macro_heap_begin(void)
+{
+    uint8_t len = macro_heap_free();
+    if(!collect(MACRO_HEAP_HDR + len, largest(MACRO_HEAP_HDR + len)))
+        return 0;
+    return len;
+}
+
+/// Write data byte at offs of the new macro, see macro_heap_begin().
+void macro_heap_put(uint8_t offs, uint8_t value)
+{
+    heap_write_byte(heap_head + MACRO_HEAP_HDR + offs, value);
+}
+
+/**
+ * Store new macro sel of given length, replacing an existing one.
+ * @return false if sel is no letter or digit.
+ */
+bool macro_heap_commit(char sel, uint8_t len)
+{
+    int8_t i = sel_index(sel);
+    if(i < 0)
+        return false;
+
+    uint16_t old = heap_index[i].rec; // may have moved
+    index_set(i, append(sel, len, data_crc(sel, len, heap_head + MACRO_HEAP_HDR)), len);
+    if(old != MACRO_HEAP_NONE)
+        heap_write_byte(old, REC_DELETED);
+    return true;
+}
+
+/**
+ * Store macro sel, replacing an existing one.
+ * @return false if sel is no letter or digit or there is not enough space.
+ */
+bool macro_heap_write(char sel, const uint8_t *data, uint8_t len)
+{
+    uint16_t size = MACRO_HEAP_HDR + len;
+    if(sel_index(sel) < 0 || !collect(size, largest(size)))
+        return false;
+
+    for(uint8_t i=0; i<len; ++i)
+        macro_heap_put(i, data[i]);
+    return macro_heap_commit(sel, len);
+}
+
+void macro_heap_delete(char sel)
+{
+    int8_t i = sel_index(sel);
+    if(i < 0 || heap_index[i].rec == MACRO_HEAP_NONE)
+        return;
+    heap_write_byte(heap_index[i].rec, REC_DELETED);
+    index_set(i, MACRO_HEAP_NONE, 0);
+}
+
+/// Longest macro that can be stored now.
+uint8_t macro_heap_free(void)
+{
+    // see collect(): a new record needs the largest one of all as reserve
+    uint16_t largest_rec = largest(0);
+    uint16_t avail = HEAP_SIZE - 1 - heap_live;
+    uint16_t size  = avail > 2*largest_rec ? avail/2 : avail-largest_rec;
+
+    if(size <= MACRO_HEAP_HDR)
+        return 0;
+    return size-MACRO_HEAP_HDR > 255 ? 255 : size-MACRO_HEAP_HDR;
+}
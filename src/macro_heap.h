@@ -0,0 +1,67 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file macro_heap.h
+ *
+ * Log-structured storage of variable length macros in the EEPROM between
+ * EE_ADDR_MACRO_HEAP and EE_ADDR_TAG.
+ *
+ * The heap is a circular log of records from its tail (oldest) to its head:
+ *
+ *     status | selector | len | crc8 | data[len]
+ *
+ * Records are appended at the head, the status is written last so a record cut
+ * by a power loss is never seen. Updates append the new version before the old
+ * one is marked deleted, so after a power loss the later of two versions wins.
+ *
+ * When space runs low, records at the tail are compacted: deleted ones are
+ * dropped, live ones are copied to the head. Writes so move through the whole
+ * area. The tail position is stored alternately in one of two slots with a
+ * sequence number and crc, a torn update leaves the previous one in place.
+ *
+ * To always be able to move a live record, free space is kept for the largest
+ * one, so a single macro may use up to a third of the heap.
+ *
+ * Selectors are letters and digits. An index in RAM holds position and length
+ * of each macro, so finding one needs no EEPROM access.
+ */
+
+#define MACRO_HEAP_NONE      0xFFFF ///< no record
+#define MACRO_HEAP_HDR       4      ///< bytes of record header
+#define MACRO_HEAP_SELECTORS (10+26+26)
+
+void     macro_heap_init(void);
+void     macro_heap_format(void);
+
+uint16_t macro_heap_find(char sel, uint8_t *len);
+char     macro_heap_next(uint8_t *it);
+void     macro_heap_read(uint16_t rec, uint8_t offs, uint8_t *dst, uint8_t n);
+
+uint8_t  macro_heap_begin(void);
+void     macro_heap_put(uint8_t offs, uint8_t value);
+bool     macro_heap_commit(char sel, uint8_t len);
+bool     macro_heap_write(char sel, const uint8_t *data, uint8_t len);
+void     macro_heap_delete(char sel);
+uint8_t  macro_heap_free(void);
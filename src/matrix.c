@@ -17,13 +17,43 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <util/atomic.h>
+#include <avr/interrupt.h>
 
 #include "config.h"
 #include "matrix.h"
+#include "debounce.h"
 #include "keyboard_class.h"
+#include "timer.h"
 
-#ifdef BLACKBOWL
+#if defined(HOST) && !defined(HAS_I2C)
+/*********************************************
+ * HOST BUILD: SIMULATED MATRIX
+ *********************************************/
+static uint8_t host_row;
+static double  host_row_us;    ///< simulated time the row was activated
+
+column_size_t read_col(void)
+{
+    double settled = host_now_us() - host_row_us;
+    if(settled < host_settle_min_us)
+        host_settle_min_us = settled;
+    return ~host_matrix[host_row];
+}
+
+static inline void unselect_rows(void) {}
+
+static inline void activate(uint8_t row)
+{
+    host_row    = row;
+    host_row_us = host_now_us();
+}
+
+bool init_cols(void)
+{
+    return true;
+}
+
+#elif defined(BLACKBOWL)
 #include "mcp23018.h"
 
 // these are the initially tested hardwired addresses that should work
@@ -31,6 +61,137 @@
 static uint8_t i2c_adr[2] = {0x46, 0x4E};
 static bool i2c_left = 0;
 
+#ifdef MCP23018_BURST_SCAN
+/*
+ * Asynchronous scan: a chain of queued TWI transfers walks all rows, each
+ * completion callback submits the next step. scan_matrix() debounces only
+ * once all rows have arrived, so USB is serviced while the bus is busy.
+ *
+ * Per row, the column is selected by writing IODIRA, which implicitly
+ * releases the previous one on the same expander. Only when crossing
+ * halves must the old expander be released first.
+ */
+enum { SCAN_RELEASE, SCAN_SELECT, SCAN_READ, IDLE_DRIVE, IDLE_READ };
+
+static twi_xfer_t     scan_xfer;
+static uint8_t        scan_buf;
+static uint8_t        scan_op;
+static uint8_t        scan_row;
+static column_size_t  scan_rows[ROWS];  ///< raw row data, active low
+static volatile bool  scan_done;        ///< scan_rows complete, next scan not started
+
+/*
+ * Idle mode: with no key down, all columns of both halves are driven low,
+ * so one read per half tells whether any key is pressed. Full scans resume
+ * when INTB signals a change, or when polling both halves finds a key.
+ */
+static bool           idle_mode;
+static bool           idle_arm;         ///< columns still need to be driven low
+static uint8_t        idle_quiet;       ///< full scans without any key down
+
+/// Quiet scans before idling, so lockouts and counters of the debounce engine have run out.
+#define IDLE_AFTER_SCANS 4
+static uint8_t        idle_rows;        ///< rows of both halves and'ed, active low
+
+static void scan_next(twi_xfer_t *x);
+
+/// Queue transfer for scan_op of scan_row, scan_next() continues when done.
+static void scan_submit(void)
+{
+    uint8_t adr = i2c_adr[i2c_left];
+    switch(scan_op) {
+        case SCAN_RELEASE:
+            mcp23018_xfer_col(&scan_xfer, adr, 0xFF, &scan_buf);
+            break;
+        case SCAN_SELECT:
+            mcp23018_xfer_col(&scan_xfer, adr, i2c_left ? 7-scan_row : 3-scan_row, &scan_buf);
+            break;
+        case SCAN_READ:
+        case IDLE_READ:
+            mcp23018_xfer_rows(&scan_xfer, adr, &scan_buf);
+            break;
+        case IDLE_DRIVE:
+            mcp23018_xfer_cols(&scan_xfer, adr, 0x00, &scan_buf);
+            break;
+    }
+    scan_xfer.done = scan_next;
+    twi_submit(&scan_xfer);
+}
+
+static void scan_row_begin(void)
+{
+    scan_op = ((scan_row>=4) != i2c_left) ? SCAN_RELEASE : SCAN_SELECT;
+    scan_submit();
+}
+
+static void scan_next(twi_xfer_t *x)
+{
+    switch(scan_op) {
+        case SCAN_RELEASE:
+            i2c_left = !i2c_left;
+            scan_op = SCAN_SELECT;
+            break;
+        case SCAN_SELECT:
+            scan_op = SCAN_READ;
+            break;
+        case SCAN_READ:
+            // unreachable half reads as all keys released
+            scan_rows[scan_row] = (x->status == TWI_OK) ? scan_buf : 0xFF;
+            if(++scan_row == ROWS) {
+                scan_done = true;
+                return;
+            }
+            scan_row_begin();
+            return;
+        case IDLE_DRIVE:
+            scan_op = IDLE_READ;
+            break;
+        case IDLE_READ:
+            if(x->status == TWI_OK)
+                idle_rows &= scan_buf;
+            if(i2c_left) {
+                scan_done = true;
+                return;
+            }
+            i2c_left = true;
+            scan_op = idle_arm ? IDLE_DRIVE : IDLE_READ;
+            break;
+    }
+    scan_submit();
+}
+
+static void scan_start(void)
+{
+    scan_done = false;
+    scan_row  = 0;
+    scan_row_begin();
+}
+
+/**
+ * Read rows of both halves with all columns low, driving them low first if arm is set.
+ * Always ends on the second half, so the next full scan releases it before row 0.
+ */
+static void idle_check(bool arm)
+{
+    scan_done = false;
+    idle_arm  = arm;
+    idle_rows = 0xFF;
+    i2c_left  = false;
+    scan_op   = arm ? IDLE_DRIVE : IDLE_READ;
+    scan_submit();
+}
+
+/// Whether a change may have happened while idle. Reading GPIOB clears the interrupt.
+static inline bool idle_changed(void)
+{
+#ifdef MCP23018_INT_PIN
+    return !(MCP23018_INT_PIN & (1<<MCP23018_INT_BIT));
+#else
+    return true;
+#endif
+}
+
+#else
 // this must be called once before matrix_scan.
 column_size_t read_col(void)
 {
@@ -63,6 +224,29 @@ static inline void activate(uint8_t row)
         mcp23018_col_low(7-row);
     }
 }
+#endif // MCP23018_BURST_SCAN
+
+#ifdef MCP23018_BURST_SCAN
+/// Configure both detected expanders once, then hand the bus to the TWI queue.
+static bool init_burst(void)
+{
+    i2c_stop(); // probing leaves the bus claimed
+    if( !mcp23018_setup_burst(i2c_adr[0]) || !mcp23018_setup_burst(i2c_adr[1]) )
+        return false;
+    i2c_left = true; // expander configured last
+
+    twi_queue_init();
+    for(uint8_t row=0; row<ROWS; ++row)
+        scan_rows[row] = 0xFF;
+    scan_done = true;
+
+#ifdef MCP23018_INT_PIN
+    MCP23018_INT_DDR  &= ~(1<<MCP23018_INT_BIT); // input with pullup, open drain outputs
+    MCP23018_INT_PORT |=  (1<<MCP23018_INT_BIT);
+#endif
+    return true;
+}
+#endif
 
 /**
  * Only called once during keyboard initialization.
@@ -74,7 +258,11 @@ bool init_cols(void)
 
     // detect both attached MCP23018 which should be on addresses +3 and +7
     if( mcp23018_init_addr(i2c_adr[0]) && mcp23018_init_addr(i2c_adr[1]) ) {
+#ifdef MCP23018_BURST_SCAN
+        return init_burst();
+#else
         return true;
+#endif
     }
     _delay_ms(500);
 
@@ -98,7 +286,11 @@ bool init_cols(void)
     if(i2c_adr[1] == 0xFF) // did not find second one
         return false;
 
+#ifdef MCP23018_BURST_SCAN
+    return init_burst();
+#else
     return true;
+#endif
 }
 
 
@@ -325,94 +517,268 @@ bool init_cols(void)
 
 
 /// debounce variables
-volatile column_size_t kb_state[ROWS];    // debounced and inverted key state: bit = 1: key pressed
-volatile column_size_t kb_press[ROWS];    // key press detect
-volatile column_size_t kb_release[ROWS];  // key release detect
-volatile column_size_t kb_rpt[ROWS];      // key long press and repeat
+static column_size_t kb_state[ROWS];    // debounced and inverted key state: bit = 1: key pressed
+static uint16_t rpt[ROWS];   // time of next repeat
+
+/// all lower COLS bits set, computed in column_size_t so it holds for 8 and 16 bit words
+#define ALL_COLS_MASK ((column_size_t)(~(column_size_t)0) >> (8*sizeof(column_size_t) - COLS))
+#define REPEAT_MASK    ALL_COLS_MASK // repeat: all keys
+#define REPEAT_START   500           // ms
+#define REPEAT_NEXT    250
+
+
+/**
+ * Key event queue between scan_matrix() and the main loop.
+ *
+ * Single producer (scan_matrix(), usually in timer ISR context) and single consumer
+ * (matrix_pop_event() from main loop). Both indices are free running 8 bit counters,
+ * each only written by one side, so no locking is required.
+ */
+#define KEYEVENT_BUF_SIZE 16 // must be a power of two
+#define KEYEVENT_BUF_MASK (KEYEVENT_BUF_SIZE-1)
+
+static keyevent_t       ev_buf[KEYEVENT_BUF_SIZE];
+static volatile uint8_t ev_head; ///< written by producer only
+static volatile uint8_t ev_tail; ///< written by consumer only
+
+// prevent compiler from moving buffer accesses across index updates
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+static inline uint8_t ev_free(void)
+{
+    return KEYEVENT_BUF_SIZE - (uint8_t)(ev_head - ev_tail);
+}
+
+static inline void ev_push(uint8_t row, uint8_t col, uint8_t change)
+{
+    keyevent_t *ev = &ev_buf[ev_head & KEYEVENT_BUF_MASK];
+    ev->id     = (row<<4|col);
+    ev->change = change;
+    ev->time   = timer_read();
+    barrier();
+    ++ev_head;
+}
 
-static column_size_t ct0[ROWS], ct1[ROWS];
-static int32_t rpt[ROWS];
+/**
+ * Fetch the oldest pending key event.
+ * @return false if queue is empty.
+ */
+bool matrix_pop_event(keyevent_t *ev)
+{
+    uint8_t tail = ev_tail;
+    if(tail == ev_head)
+        return false;
 
-#define ALL_COLS_MASK ((1<<COLS)-1)  // 0x63 or all lower 6 bits
-#define REPEAT_MASK    ALL_COLS_MASK // repeat: key0 = 0x3F = 63
-#define REPEAT_START   31            // 61 = 1000ms
-#define REPEAT_NEXT    15
+    *ev = ev_buf[tail & KEYEVENT_BUF_MASK];
+    barrier();
+    ev_tail = tail+1;
+    return true;
+}
 
+static uint8_t count_bits(column_size_t c)
+{
+    uint8_t n=0;
+    for(; c; c &= c-1)
+        ++n;
+    return n;
+}
 
-column_size_t get_kb_release( column_size_t key_mask, uint8_t col)
+/// Queue events of changed columns only, in ascending column order.
+static void queue_changes(uint8_t row, column_size_t p, column_size_t h, column_size_t r)
 {
-    ATOMIC_BLOCK(ATOMIC_FORCEON) {
-        key_mask &= kb_release[col];                      // read key(s)
-        kb_release[col] ^= key_mask;                      // clear key(s)
+    for(column_size_t c = p|h|r; c; c &= c-1) {
+        uint8_t col = column_ffs(c);
+        column_size_t mask = c & -c;
+        if(p&mask)
+            ev_push(row, col, KEY_PRESS);
+        if(h&mask)
+            ev_push(row, col, KEY_HOLD);
+        if(r&mask)
+            ev_push(row, col, KEY_RELEASE);
     }
-    return key_mask;
 }
 
-column_size_t get_kb_press( column_size_t key_mask, uint8_t col )
+/**
+ * Debounce one row of raw column data and queue resulting key events.
+ * Engine is selected in config.h, see debounce.h.
+ */
+static inline void debounce_row(uint8_t row, column_size_t data)
 {
-    ATOMIC_BLOCK(ATOMIC_FORCEON) {
-        key_mask &= kb_press[col];                      // read key(s)
-        kb_press[col] ^= key_mask;                      // clear key(s)
+    column_size_t i;
+    uint16_t now = timer_read();
+
+    i = debounce(row, ~data & ALL_COLS_MASK, kb_state[row]);
+
+    column_size_t h=0;
+    if( (int16_t)(now - rpt[row]) >= 0 ) {
+        h = kb_state[row] & REPEAT_MASK;
+    }
+
+    // Queue full: keep debounced state, the engine reports the change again later.
+    if( ev_free() < count_bits(i) + count_bits(h) )
+        return;
+
+    kb_state[row] ^= i;                             // then toggle debounced state
+
+    if( (kb_state[row] & REPEAT_MASK) == 0 ) {      // check repeat function
+        rpt[row] = now + REPEAT_START;              // start delay
+    }
+    h &= kb_state[row];
+    if(h) {
+        rpt[row] = now + REPEAT_NEXT;               // repeat delay
     }
-    return key_mask;
+
+    column_size_t p,r;
+    p =  kb_state[row] & i;                         // 0->1: key press detect
+    r = ~kb_state[row] & i;                         // 1->0: key release detect
+
+    if(p|h|r)
+        queue_changes(row, p,h,r);
 }
 
-column_size_t get_kb_rpt( column_size_t key_mask, uint8_t col )
+#ifdef MATRIX_SCAN_IN_ISR
+/// Scan timer counts for MATRIX_SETTLE_US, one more as the count at start may be almost over.
+#define SETTLE_COUNTS ((uint16_t)(((F_CPU/8/1000) * MATRIX_SETTLE_US + 999) / 1000 + 1))
+
+/// Scan timer count when a row was activated.
+static inline uint16_t settle_start(void)
 {
-    ATOMIC_BLOCK(ATOMIC_FORCEON) {
-        key_mask &= kb_rpt[col];                        // read key(s)
-        kb_rpt[col] ^= key_mask;                        // clear key(s)
+    return TCNT3;
+}
+
+/**
+ * Wait until the row activated at count start has settled. The count restarts at 0
+ * with the next period, which happens during a scan only if it overran its period.
+ */
+static inline void settle_wait(uint16_t start)
+{
+    for(;;) {
+        uint16_t now = TCNT3, elapsed = now - start;
+        if(now < start)
+            elapsed += OCR3A + 1;
+        if(elapsed >= SETTLE_COUNTS)
+            return;
     }
-    return key_mask;
 }
+#else
+static inline uint16_t settle_start(void) { return 0; }
+static inline void settle_wait(uint16_t start) { _delay_us(MATRIX_SETTLE_US); }
+#endif
 
 /** The real hardware access take place here.
  *  Each of the rows is individually activated and the resulting column value read.
- *  Should more than 8 channels be needed, this can easily be extended to 16/32bit.
- *  By means of a neat routine found on http://hackaday.com/2010/11/09/debounce-code-one-post-to-rule-them-all/
+ *  Up to 16 columns are read at once, in an 8 or 16 bit column_size_t.
+ *
+ *  In pipelined mode the next row is activated right after reading the current one,
+ *  so its lines settle while the current row is debounced. Only what is left of the
+ *  settle time after that is spent waiting, however long debouncing took.
  *
+ *  Called from the scan timer ISR at MATRIX_SCAN_HZ, or from the main loop on I2C boards.
+ *  Detected changes are queued as key events for the main loop.
  */
 void scan_matrix(void)
 {
-    column_size_t i, data;
+#ifdef MCP23018_BURST_SCAN
+    twi_poll();
+    if(!scan_done)
+        return;
+
+    if(idle_mode) {
+        if( (idle_rows & GPBROWS) != GPBROWS ) {
+            idle_mode = false;      // key pressed: resume full scans
+            scan_start();
+        } else if(idle_changed()) {
+            idle_check(false);
+        }
+        return;
+    }
 
+    bool any = false;
     for (uint8_t row = 0; row < ROWS; ++row) {
-        activate(row);
+        debounce_row(row, scan_rows[row]);
+        any |= (kb_state[row] != 0) || ((scan_rows[row] & GPBROWS) != GPBROWS);
+    }
+    if(any)
+        idle_quiet = 0;
+    if(any || ++idle_quiet < IDLE_AFTER_SCANS) {
+        scan_start();
+    } else {
+        idle_quiet = 0;
+        idle_mode = true;
+        idle_check(true);
+    }
+#else
+    column_size_t data;
 
-        // Insert NOPs for synchronization
-#ifndef HAS_I2C
-        _delay_us(20);
-#endif
+#if MATRIX_SCAN_PIPELINED
+    activate(0);
+    uint16_t settle = settle_start();
+    for (uint8_t row = 0; row < ROWS; ++row) {
+#  if MATRIX_SETTLE_US > 0
+        settle_wait(settle);
+#  endif
         // Place data on all column pins for active row
-        // into a single 8/16/32 bit value.
+        // into a single 8 or 16 bit value.
         data = read_col();
-        /// @see top comment for source of debounce magic
-        // Needs to be adjusted for more than 8 columns
-        i = kb_state[row] ^ (~data);                    // key changed ?
-        ct0[row] = ~( ct0[row] & i );                   // reset or count ct0
-        ct1[row] = ct0[row] ^ (ct1[row] & i);           // reset or count ct1
-        i &= ct0[row] & ct1[row];                       // count until roll over ?
-        kb_state[row] ^= i;                             // then toggle debounced state
-
-        kb_press  [row] |=  kb_state[row] & i;          // 0->1: key press detect
-        kb_release[row] |= ~kb_state[row] & i;          // 1->0: key release detect
-
-        if( (kb_state[row] & REPEAT_MASK) == 0 ) {      // check repeat function
-            rpt[row] = idle_count + REPEAT_START;       // start delay
-        }
-        if(  rpt[row] <= idle_count ) {
-            rpt[row] = idle_count + REPEAT_NEXT;        // repeat delay
-            kb_rpt[row] |= kb_state[row] & REPEAT_MASK;
+        if(row+1 < ROWS) {
+            activate(row+1);
+            settle = settle_start();
         }
 
-        // Now evaluate results
-        column_size_t p,r,h;
-        p=get_kb_press  (ALL_COLS_MASK, row);
-        h=get_kb_rpt    (ALL_COLS_MASK, row);
-        r=get_kb_release(ALL_COLS_MASK, row);
-
-        if(p|h|r)
-            keyChange(row, p,h,r);
+        debounce_row(row, data);
+    }
+#else
+    for (uint8_t row = 0; row < ROWS; ++row) {
+        activate(row);
+#  if MATRIX_SETTLE_US > 0
+        _delay_us(MATRIX_SETTLE_US);
+#  endif
+        data = read_col();
+        debounce_row(row, data);
     }
+#endif
+#endif // MCP23018_BURST_SCAN
+}
+
+
+#ifdef MATRIX_SCAN_IN_ISR
+/**
+ * Scan timer: Timer3 in CTC mode, prescaler 8. Its count also times the settle waits.
+ */
+#if F_CPU/8/MATRIX_SCAN_HZ > 65536
+    #error "MATRIX_SCAN_HZ too low for the 16 bit scan timer"
+#endif
+void init_scan_timer(void)
+{
+    TCCR3A = 0x00;
+    TCCR3B = (1<<WGM32) | (1<<CS31);
+    OCR3A  = (F_CPU/8/MATRIX_SCAN_HZ) - 1;
+    TIMSK3 = (1<<OCIE3A);
+}
+
+/**
+ * Temporarily stop matrix scanning, e.g. around timing sensitive busy-wait code.
+ * A scan that became due in between is executed once after re-enabling.
+ */
+void scan_timer_enable(bool on)
+{
+    if(on)
+        TIMSK3 |=  (1<<OCIE3A);
+    else
+        TIMSK3 &= ~(1<<OCIE3A);
 }
 
+/**
+ * The scan busy-waits for each row to settle. Only the scan timer itself stays masked
+ * while it runs, so USB, TWI and the millisecond tick are serviced in between and a
+ * scan overrunning its period is not re-entered.
+ */
+ISR(TIMER3_COMPA_vect)
+{
+    TIMSK3 &= ~(1<<OCIE3A);
+    sei();
+    scan_matrix();
+    cli();
+    TIMSK3 |=  (1<<OCIE3A);
+}
+#endif
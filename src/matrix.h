@@ -19,6 +19,48 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "keymap.h" // column_size_t
+
+/// Matrix scanning runs from a timer ISR, except where expanders must be read via I2C.
+#ifndef HAS_I2C
+    #define MATRIX_SCAN_IN_ISR
+#endif
+
+enum { KEY_RELEASE=0, KEY_PRESS=1, KEY_HOLD=2 };
+
+// Key ids hold the column in 4 bits, here and in keypress_t of keyboard_class.c
+#if COLS > 16
+    #error "More than 16 columns are not supported by key ids row<<4|col"
+#endif
+
+/// Debounced key change as emitted by scan_matrix().
+typedef struct {
+    uint8_t  id;     ///< row<<4 | col
+    uint8_t  change; ///< KEY_RELEASE, KEY_PRESS or KEY_HOLD
+    uint16_t time;   ///< timer_read() at detection
+} keyevent_t;
+
+#ifdef HOST
+/// Simulated switch state per row, bit set = pressed. Written by tools/host/host.c,
+/// read by the simulated matrix in matrix.c or the simulated expanders in tools/host/i2c.c
+extern column_size_t host_matrix[ROWS];
+/// Shortest time [us] from activating a row to reading it, of the simulated matrix.
+extern double        host_settle_min_us;
+double host_now_us(void);
+#endif
+
 bool init_cols(void);
 void scan_matrix(void);
+bool matrix_pop_event(keyevent_t *ev);
+
+#ifdef MATRIX_SCAN_IN_ISR
+void init_scan_timer(void);
+void scan_timer_enable(bool on);
+#else
+static inline void init_scan_timer(void) {}
+static inline void scan_timer_enable(bool on) {}
+#endif
 
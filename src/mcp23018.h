@@ -25,6 +25,7 @@
 
 #include <stdbool.h>
 #include "external/i2cmaster/i2cmaster.h"
+#include "twi.h"
 
 void twi_init(void);
 
@@ -35,6 +36,8 @@ void mcp23018_all_cols_highz(void);
 void mcp23018_col_low(uint8_t n);
 uint8_t mcp23018_read_rows(void);
 
+bool mcp23018_setup_burst(uint8_t addr);
+
 ///< write address of I2C slaves, base = 0x40 for MCP23018 + 3bit hw add << 1 + 1 if reading
 static uint8_t DevMCP23018;
 
@@ -43,6 +46,11 @@ static uint8_t DevMCP23018;
 #define TGPIV  0.450
 #define IODIRA 0x00
 #define IODIRB 0x01
+#define GPINTENB 0x05
+#define DEFVALA  0x06
+#define DEFVALB  0x07
+#define INTCONA  0x08
+#define INTCONB  0x09
 #define IOCONA 0x0A
 #define IOCONB 0x0B
 #define IOCON  IOCONA
@@ -53,6 +61,9 @@ static uint8_t DevMCP23018;
 #define OLATA  0x14
 #define OLATB  0x15
 
+#define IOCON_SEQOP 0x20 ///< 1 = sequential operation disabled, address pointer does not increment
+#define IOCON_ODR   0x04 ///< INT pins open drain, so both expanders can share one line
+
 //#define GPAROWS 0xFF
 #define GPBROWS 0x1F
 
@@ -134,4 +145,74 @@ uint8_t mcp23018_read_rows()
 }
 
 
+/*
+ * Burst scanning: pull-ups and output latches are configured only once,
+ * so selecting a column is a single write of IODIRA, and reading the rows
+ * a single pointer write followed by a repeated start read of GPIOB.
+ * The bus transfer alone exceeds tGPOV and tGPIV, so no extra delays needed.
+ *
+ * Setup is done blocking during init, scan transfers then go through the
+ * interrupt driven queue in twi.c.
+ */
+
+/**
+ * Probe expander at addr and set it up for burst scanning.
+ * Uses sequential mode to write interrupt config, IOCON, GPPUA and GPPUB in one go.
+ * INTB fires on any change of the used rows, compared to their previous value.
+ * @return false if device does not respond.
+ */
+bool mcp23018_setup_burst(uint8_t addr)
+{
+    DevMCP23018 = addr;
+    if( i2c_start(DevMCP23018+I2C_WRITE) ) {
+        i2c_stop();
+        return false;
+    }
+    i2c_write(GPINTENB);
+    i2c_write(GPBROWS);  // GPINTENB: interrupt on change of used rows
+    i2c_write(0x00);     // DEFVALA
+    i2c_write(0x00);     // DEFVALB
+    i2c_write(0x00);     // INTCONA
+    i2c_write(0x00);     // INTCONB : compare against previous value
+    i2c_write(IOCON_ODR);// IOCONA  : BANK=0, SEQOP=0 -> address pointer increments
+    i2c_write(IOCON_ODR);// IOCONB  : same register
+    i2c_write(0x00);     // GPPUA : no pullups on columns
+    i2c_write(GPBROWS);  // GPPUB : pullups for used rows
+    i2c_stop();
+
+    i2c_start_wait(DevMCP23018+I2C_WRITE);
+    i2c_write(IODIRA);
+    i2c_write(0xFF);     // IODIRA: all columns high-z
+    i2c_write(0xFF);     // IODIRB: rows are inputs
+    i2c_stop();
 
+    mcp23018_write_register(OLATA, 0x00); // selected column drives low
+    return true;
+}
+
+/// Prepare transfer that sets column directions, 0 = driven low.
+static inline void mcp23018_xfer_cols(twi_xfer_t *x, uint8_t addr, uint8_t dir, uint8_t *buf)
+{
+    *buf    = dir;
+    x->addr = addr;
+    x->reg  = IODIRA;
+    x->wlen = 1;
+    x->rlen = 0;
+    x->data = buf;
+}
+
+/// Prepare transfer that drives column n low and all others high-z. Any n > 7 releases all columns.
+static inline void mcp23018_xfer_col(twi_xfer_t *x, uint8_t addr, uint8_t n, uint8_t *buf)
+{
+    mcp23018_xfer_cols(x, addr, n<8 ? ~_BV(n) : 0xFF, buf);
+}
+
+/// Prepare transfer that reads the row inputs using a repeated start.
+static inline void mcp23018_xfer_rows(twi_xfer_t *x, uint8_t addr, uint8_t *buf)
+{
+    x->addr = addr;
+    x->reg  = GPIOB;
+    x->wlen = 0;
+    x->rlen = 1;
+    x->data = buf;
+}
@@ -24,7 +24,8 @@
 #include <stdint.h>
 #include <util/delay.h>
 #include "hid_usage.h"
-#include "keyboard_class.h" // idle_count, should go into timer
+#include "keyboard_class.h"
+#include "timer.h"
 #include "mousekey.h"
 #include "print.h"
 
@@ -61,9 +62,9 @@ USB_WheelMouseReport_Data_t mkr = {0};
 
 static uint8_t mousekey_accel = 0;
 
-static uint32_t first_press_timer = 0;
-static uint32_t last_sent = 0;
-static uint32_t delta_in_ms;
+static uint16_t first_press_timer;
+static uint16_t last_sent;
+static uint16_t delta_in_ms;    ///< since first press, stops once acceleration is at maximum
 
 static void mousekey_debug(void);
 
@@ -111,10 +112,9 @@ void mousekey_activate(uint16_t mask)
         mousekey_clear();
         return;
     }
-    if(first_press_timer == 0)
-        first_press_timer = idle_count;
-
-    delta_in_ms = (idle_count-first_press_timer)*1000/61;
+    // first_press_timer is restarted in mousekey_clear() while no key is pressed
+    if(delta_in_ms < MK_VH_DELAY+MK_VH_TTM)
+        delta_in_ms = timer_elapsed(first_press_timer);
 
     for(uint8_t c=0; c<16; ++c) {
         if(mask & (1<<c))
@@ -186,12 +186,12 @@ uint8_t getMouseKeyReport(USB_WheelMouseReport_Data_t *MouseReport)
     if(mkr.Button == 0) {
         if(mkr.X == 0 && mkr.Y == 0 && mkr.V == 0 && mkr.H == 0) {
             return 0;
-        } else if ((idle_count-last_sent)*1000/61 < MS_PER_REPORT ) {
+        } else if (timer_elapsed(last_sent) < MS_PER_REPORT ) {
             return 0;
         }
     }
 
-    last_sent=idle_count;
+    last_sent=timer_read();
 
     if (mkr.X && mkr.Y) {
         // lower speed on diagonal movement: 3/4 close enough to sqrt(2) for 45deg angles, and others are fine with this, too.
@@ -214,11 +214,12 @@ void mousekey_clear(void)
         mousekey_off(MS_BEGIN+c);
     mkr = (USB_WheelMouseReport_Data_t) {};
     mousekey_accel = 0;
-    first_press_timer=0;
+    first_press_timer=timer_read();
+    delta_in_ms=0;
 }
 
 static void mousekey_debug(void)
 {
     xprintf("\n%02X |%d,%d %d,%d (acc %d)] ", mkr.Button, mkr.X, mkr.Y, mkr.V, mkr.H, mousekey_accel);
-    xprintf("%lu", (idle_count-first_press_timer));
+    xprintf("%u", delta_in_ms);
 }
@@ -22,8 +22,10 @@
 #include "ps2mouse.h"
 #include "trackpoint.h"
 #include "keyboard_class.h" // enable_mouse_keys()
+#include "matrix.h"
+#include "timer.h"
 
-volatile uint32_t    mouse_timer; /// toggle mouse mode for a specified time
+static uint16_t      mouse_timer; /// toggle mouse mode for a specified time
 volatile uint16_t    accel; /// toggle mouse mode for a specified time
 
 /**
@@ -96,6 +98,10 @@ void ps2_read_mouse(int8_t *dx, int8_t *dy, int8_t *BTNS )
     int mouseinf;
     {
         uint8_t rcv;
+#ifdef PS2_USE_BUSYWAIT
+        // matrix scan ISR would stretch the busy-wait clock sampling
+        scan_timer_enable(false);
+#endif
         rcv = ps2_host_send(PS2_MOUSE_READ_DATA);
         if(rcv == PS2_ACK) {
             mouseinf=ps2_host_recv_response();
@@ -114,11 +120,12 @@ void ps2_read_mouse(int8_t *dx, int8_t *dy, int8_t *BTNS )
             *dy=  Y_IS_NEG ?
                   ((!Y_IS_OVF && -127 <= *dy && *dy <= -1) ?  *dy : -127) :
                   ((!Y_IS_OVF && 0 <= *dy && *dy <= 127) ? *dy : 127);
-
-            return;
         } else {
             xprintf("\nERR read_mouse %0X", rcv);
         }
+#ifdef PS2_USE_BUSYWAIT
+        scan_timer_enable(true);
+#endif
     }
 }
 
@@ -146,14 +153,14 @@ uint8_t getMouseReport(USB_WheelMouseReport_Data_t *MouseReport)
             accel=0;
         }
 
-        mouse_timer=idle_count;
+        mouse_timer=timer_read();
         if(accel<ACC_RAMPTIME)
             accel++;
 
-        // reset mouse mode after inactivity: idle_count is incremented 61 times per second
+        // reset mouse mode after inactivity
         // After last detected trackpoint movement that much time remains to press a button.
     } else {
-        if(idle_count-mouse_timer > 1/*seconds*/ *61 ) {
+        if(timer_elapsed(mouse_timer) > 1000/*ms*/ ) {
             enable_mouse_keys(0);
             accel=0;
         }
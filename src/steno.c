@@ -0,0 +1,102 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "steno.h"
+#include "keymap.h"
+#include "matrix.h"
+#include "print.h"
+
+#ifdef STENO
+
+#define STENO_QUEUE_SIZE 4 // must be a power of two
+
+static bool    steno_on;
+static uint8_t steno_chord[STENO_PACKET_SIZE];  ///< keys of current chord
+static uint8_t steno_down;                      ///< steno keys still pressed
+
+/// Packets not yet fetched by the host, written in keyIdChange(), read in the USB task.
+static uint8_t steno_queue[STENO_QUEUE_SIZE][STENO_PACKET_SIZE];
+static uint8_t steno_head, steno_tail;
+
+
+void steno_enable(bool on)
+{
+    steno_on = on;
+    steno_down = 0;
+    memset(steno_chord, 0, sizeof(steno_chord));
+    xprintf("Steno %d\n", on);
+}
+
+bool steno_active(void)
+{
+    return steno_on;
+}
+
+/// Queue the finished chord, dropped if the host does not keep up.
+static void steno_send(void)
+{
+    if((uint8_t)(steno_head - steno_tail) >= STENO_QUEUE_SIZE)
+        return;
+
+    uint8_t *packet = steno_queue[steno_head & (STENO_QUEUE_SIZE-1)];
+    memcpy(packet, steno_chord, STENO_PACKET_SIZE);
+    packet[0] |= 0x80;
+    ++steno_head;
+
+    memset(steno_chord, 0, sizeof(steno_chord));
+}
+
+/**
+ * Add a key change to the current chord.
+ * @return false if the key has no steno meaning and is to be handled regularly.
+ */
+bool steno_key(uint8_t row, uint8_t col, uint8_t change)
+{
+    uint8_t key = getStenoKey(row, col);
+    if(key == ST__)
+        return false;
+
+    uint8_t bit = key-1;
+    if(change == KEY_PRESS) {
+        steno_chord[bit/7] |= (0x40 >> (bit%7));
+        ++steno_down;
+    } else if(change == KEY_RELEASE && steno_down) {
+        if(--steno_down == 0)
+            steno_send();
+    }
+    return true;
+}
+
+/**
+ * Fetch the next GeminiPR packet for the steno interface.
+ * @return packet size, 0 if none is pending.
+ */
+uint8_t steno_get_report(uint8_t *packet)
+{
+    if(steno_tail == steno_head)
+        return 0;
+
+    memcpy(packet, steno_queue[steno_tail & (STENO_QUEUE_SIZE-1)], STENO_PACKET_SIZE);
+    ++steno_tail;
+    return STENO_PACKET_SIZE;
+}
+
+#endif // STENO
@@ -0,0 +1,55 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file steno.h
+ *
+ * Steno mode: all keys pressed in a chord are collected and sent as one GeminiPR
+ * packet once every key is released. Packets go out over their own vendor HID
+ * interface, a host side bridge forwards them to the steno software.
+ *
+ * Matrix positions map to steno keys through StenoMatrix[] in keymap.h,
+ * positions without a steno key keep their regular meaning.
+ */
+
+#define STENO_PACKET_SIZE 6
+
+/**
+ * Steno keys in GeminiPR bit order: 7 keys per byte starting at bit 6,
+ * bit 7 is only set in the first byte. 0 is used for no steno key.
+ */
+enum steno_key {
+    ST__ = 0,
+    ST_FN,  ST_N1,  ST_N2,  ST_N3,  ST_N4,  ST_N5,  ST_N6,
+    ST_S1,  ST_S2,  ST_TL,  ST_KL,  ST_PL,  ST_WL,  ST_HL,
+    ST_RL,  ST_A,   ST_O,   ST_ST1, ST_ST2, ST_RES1,ST_RES2,
+    ST_PWR, ST_ST3, ST_ST4, ST_E,   ST_U,   ST_FR,  ST_RR,
+    ST_PR,  ST_BR,  ST_LR,  ST_GR,  ST_TR,  ST_SR,  ST_DR,
+    ST_N7,  ST_N8,  ST_N9,  ST_NA,  ST_NB,  ST_NC,  ST_ZR,
+};
+
+void steno_enable(bool on);
+bool steno_active(void);
+bool steno_key(uint8_t row, uint8_t col, uint8_t change);
+uint8_t steno_get_report(uint8_t *packet);
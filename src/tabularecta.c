@@ -76,9 +76,15 @@ int8_t encrypt(uint8_t * data, uint8_t len)
 }
 
 int8_t decrypt(uint8_t * data, uint8_t len)
+{
+    return decrypt_at(data, len, 0);
+}
+
+/// Decrypt part of a longer block, that starts at offs within it.
+int8_t decrypt_at(uint8_t * data, uint8_t len, uint8_t offs)
 {
     for(uint8_t i=0; i<len; ++i)
-        data[i] ^= g_pw[i%PWLEN];
+        data[i] ^= g_pw[(offs+i)%PWLEN];
     return len;
 }
 
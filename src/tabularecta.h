@@ -51,6 +51,7 @@ uint16_t pwfingerprint(void);
 
 int8_t encrypt(uint8_t * data, uint8_t len);
 int8_t decrypt(uint8_t * data, uint8_t len);
+int8_t decrypt_at(uint8_t * data, uint8_t len, uint8_t offs);
 void tabula_recta(uint8_t * dst, char row, uint8_t col, uint8_t dig);
 void hmac_tag(uint8_t * result, uint8_t result_len, char * tag, uint8_t tag_len, uint8_t offs);
 void unlock(uint8_t * code, uint8_t len);
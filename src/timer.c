@@ -0,0 +1,106 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "timer.h"
+
+volatile uint16_t timer_ms;
+volatile uint16_t timer_s;
+
+static uint16_t sub_s; ///< ms within current second
+
+/// Scheduled events, unused while callback is NULL.
+static struct {
+    timer_callback_t callback;
+    uint16_t         start;  ///< timer_read() when scheduled
+    uint16_t         delay;  ///< [ms]
+} events[TIMER_EVENTS];
+
+/**
+ * Timer0 in CTC mode, prescaler 64: 16MHz/64/250 = 1 kHz.
+ */
+void timer_init(void)
+{
+    TCCR0A = (1<<WGM01);
+    TCCR0B = (1<<CS01) | (1<<CS00);
+    OCR0A  = (F_CPU/64/1000) - 1;
+    TIMSK0 = (1<<OCIE0A);
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+    ++timer_ms;
+    if(++sub_s == 1000) {
+        sub_s = 0;
+        ++timer_s;
+    }
+}
+
+
+/**
+ * Call callback once from timer_task() after delay [ms].
+ * A pending event with the same callback is rescheduled.
+ *
+ * @return false if all TIMER_EVENTS are in use.
+ */
+bool timer_schedule(uint16_t delay, timer_callback_t callback)
+{
+    timer_cancel(callback);
+    for(uint8_t i=0; i<TIMER_EVENTS; ++i) {
+        if(events[i].callback == NULL) {
+            events[i].start    = timer_read();
+            events[i].delay    = delay;
+            events[i].callback = callback;
+            return true;
+        }
+    }
+    return false;
+}
+
+void timer_cancel(timer_callback_t callback)
+{
+    for(uint8_t i=0; i<TIMER_EVENTS; ++i) {
+        if(events[i].callback == callback)
+            events[i].callback = NULL;
+    }
+}
+
+bool timer_pending(timer_callback_t callback)
+{
+    for(uint8_t i=0; i<TIMER_EVENTS; ++i) {
+        if(events[i].callback == callback)
+            return true;
+    }
+    return false;
+}
+
+/// Run callbacks of expired events, to be called from the main loop.
+void timer_task(void)
+{
+    for(uint8_t i=0; i<TIMER_EVENTS; ++i) {
+        timer_callback_t callback = events[i].callback;
+        if(callback != NULL && timer_elapsed(events[i].start) >= events[i].delay) {
+            events[i].callback = NULL; // free before the call, it may schedule again
+            callback();
+        }
+    }
+}
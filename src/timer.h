@@ -0,0 +1,83 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+
+/**
+ * @file timer.h
+ *
+ * Monotonic millisecond timebase from Timer0 compare match at 1 kHz.
+ *
+ * Times are free running 16 bit counters, so only differences are meaningful and
+ * intervals up to 65 s can be measured with timer_elapsed(), even across the wrap.
+ * Longer timeouts like the auto-lock use the seconds counter instead.
+ *
+ * Timed events call a function once after a delay. They are run from timer_task()
+ * in the main loop, not from the interrupt, so callbacks may use any state.
+ */
+
+#define TIMER_EVENTS 2 ///< number of events pending at the same time
+
+typedef void (*timer_callback_t)(void);
+
+extern volatile uint16_t timer_ms; ///< use timer_read()
+extern volatile uint16_t timer_s;  ///< use timer_read_s()
+
+void timer_init(void);
+
+bool timer_schedule(uint16_t delay, timer_callback_t callback);
+void timer_cancel(timer_callback_t callback);
+bool timer_pending(timer_callback_t callback);
+void timer_task(void);
+
+/// Current time [ms]
+static inline uint16_t timer_read(void)
+{
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = timer_ms;
+    }
+    return t;
+}
+
+/// Time [ms] passed since given timer_read(), must be less than 65 s ago.
+static inline uint16_t timer_elapsed(uint16_t since)
+{
+    return timer_read() - since;
+}
+
+/// Current time [s]
+static inline uint16_t timer_read_s(void)
+{
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = timer_s;
+    }
+    return t;
+}
+
+/// Time [s] passed since given timer_read_s().
+static inline uint16_t timer_elapsed_s(uint16_t since)
+{
+    return timer_read_s() - since;
+}
@@ -0,0 +1,56 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "trace.h"
+#include "timer.h"
+#include "print.h"
+
+#ifdef KEY_TRACE
+
+trace_t trace_buf[TRACE_SIZE];
+uint8_t trace_head;
+
+/// Add report modifier and its keys.
+void trace_report(USB_KeyboardReport_Data_t *report, uint16_t time)
+{
+    trace_add(TRACE_REPORT, report->Modifier, time);
+    for(uint8_t i=0; i<6 && report->KeyCode[i]; ++i)
+        trace_add(TRACE_REPORT_KEY, report->KeyCode[i], time);
+}
+
+/**
+ * Print all records, oldest first, and clear the buffer.
+ */
+void trace_dump(void)
+{
+    uint8_t n = trace_head < TRACE_SIZE ? trace_head : TRACE_SIZE;
+    uint8_t i = trace_head - n;
+
+    xprintf("\nTRACE %u %04X", n, timer_read());
+    for(uint8_t k=0; k<n; ++k, ++i) {
+        trace_t *t = &trace_buf[i & (TRACE_SIZE-1)];
+        if(k%8 == 0)
+            xprintf("\nTR");
+        xprintf(" %04X:%02X%02X", t->time, t->type, t->data);
+    }
+    xprintf("\nTRACE END\n");
+    trace_head = 0;
+}
+
+#endif // KEY_TRACE
@@ -0,0 +1,82 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "Keyboard.h"
+
+/**
+ * @file trace.h
+ *
+ * Ring buffer of timestamped key events, dual use decisions and reports, enabled
+ * with KB_TRACE=1. Recording only stores a 4 byte record, the buffer is printed
+ * over the debug endpoint from command mode and decoded by tools/tracedecode.c.
+ *
+ * Each record is dumped as "tttt:yydd" in hex: time [ms], type and data.
+ */
+
+enum trace_type {
+    TRACE_RELEASE   = 0,    ///< matrix event, data is key id, equals KEY_RELEASE..KEY_HOLD
+    TRACE_PRESS     = 1,
+    TRACE_HOLD      = 2,
+    TRACE_DUAL_HOLD,        ///< dual use key decided, data is key id
+    TRACE_DUAL_TAP,
+    TRACE_REPORT,           ///< report built, data is modifier, followed by its keys
+    TRACE_REPORT_KEY,       ///< data is hid code
+    TRACE_COMBO,            ///< combo matched, data is index in ComboKeys[]
+};
+
+#ifdef KEY_TRACE
+
+#ifndef DEBUG_OUTPUT
+    #error "Trace is dumped over the debug endpoint, needs KB_DBG=1"
+#endif
+
+#define TRACE_SIZE 64 // must be a power of two
+
+typedef struct {
+    uint16_t time;
+    uint8_t  type;
+    uint8_t  data;
+} trace_t;
+
+extern trace_t trace_buf[TRACE_SIZE];
+extern uint8_t trace_head; ///< records added, kept below 2*TRACE_SIZE once full
+
+static inline void trace_add(uint8_t type, uint8_t data, uint16_t time)
+{
+    trace_t *t = &trace_buf[trace_head++ & (TRACE_SIZE-1)];
+    t->time = time;
+    t->type = type;
+    t->data = data;
+    if(trace_head == 2*TRACE_SIZE)
+        trace_head = TRACE_SIZE;
+}
+
+void trace_report(USB_KeyboardReport_Data_t *report, uint16_t time);
+void trace_dump(void);
+
+#else
+
+static inline void trace_add(uint8_t type, uint8_t data, uint16_t time) {}
+static inline void trace_report(USB_KeyboardReport_Data_t *report, uint16_t time) {}
+static inline void trace_dump(void) {}
+
+#endif
@@ -0,0 +1,231 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include <compat/twi.h>
+
+#include "config.h"
+#include "twi.h"
+#include "timer.h"
+
+#ifdef HAS_I2C
+
+#ifndef SCL_CLOCK
+    #define SCL_CLOCK  400000L
+#endif
+
+#define TWI_QUEUE_SIZE 4 // must be a power of two
+#define TWI_QUEUE_MASK (TWI_QUEUE_SIZE-1)
+#define TWI_TIMEOUT_MS 20
+
+// ATmega32U4: SCL on PD0, SDA on PD1
+#define TWI_SCL (1<<0)
+#define TWI_SDA (1<<1)
+
+#define TWCR_NEXT ((1<<TWINT)|(1<<TWEN)|(1<<TWIE))
+#define TWCR_STOP ((1<<TWINT)|(1<<TWEN)|(1<<TWSTO))
+
+volatile twi_errors_t twi_errors;
+
+static twi_xfer_t *queue[TWI_QUEUE_SIZE];
+static volatile uint8_t q_head, q_tail;
+
+static volatile bool     busy;    ///< transfer at queue tail is on the bus
+static volatile uint16_t started; ///< timer_read() when it was started
+static uint8_t pos;               ///< data byte index
+static bool    reading;           ///< past the repeated start
+
+#define count_error(e) do { if(twi_errors.e < 0xFF) ++twi_errors.e; } while(0)
+
+static void twi_start(void)
+{
+    while(TWCR & (1<<TWSTO))
+        ; // previous stop condition still in progress, takes a few µs
+    pos     = 0;
+    reading = false;
+    started = timer_read();
+    busy    = true;
+    TWCR = TWCR_NEXT | (1<<TWSTA);
+}
+
+/// Finish transfer at queue tail and start the next one, if any.
+static void twi_complete(uint8_t status)
+{
+    twi_xfer_t *x = queue[q_tail & TWI_QUEUE_MASK];
+    ++q_tail;
+    busy = false;
+
+    x->status = status;
+    if(x->done)
+        x->done(x);
+
+    if(!busy && q_tail != q_head)
+        twi_start();
+}
+
+/**
+ * Clock out a slave that holds SDA low in the middle of a byte, then issue a stop.
+ * Pins are driven open drain by toggling their direction with output latch low.
+ */
+static void twi_recover(void)
+{
+    TWCR = 0;
+    PORTD &= ~(TWI_SCL|TWI_SDA);
+    DDRD  &= ~(TWI_SCL|TWI_SDA);
+    _delay_us(5);
+
+    for(uint8_t i=0; i<9 && !(PIND & TWI_SDA); ++i) {
+        DDRD |=  TWI_SCL;
+        _delay_us(5);
+        DDRD &= ~TWI_SCL;
+        _delay_us(5);
+    }
+
+    // stop condition: SDA rises while SCL is high
+    DDRD |=  TWI_SCL;
+    DDRD |=  TWI_SDA;
+    _delay_us(5);
+    DDRD &= ~TWI_SCL;
+    _delay_us(5);
+    DDRD &= ~TWI_SDA;
+    _delay_us(5);
+
+    count_error(recovered);
+    TWCR = (1<<TWEN);
+}
+
+void twi_queue_init(void)
+{
+    TWSR = 0;                         // prescaler 1
+    TWBR = ((F_CPU/SCL_CLOCK)-16)/2;  // must be > 10 for stable operation
+    TWCR = (1<<TWEN);
+    q_head = q_tail = 0;
+    busy = false;
+}
+
+/**
+ * Queue a transfer, starting it right away if the bus is idle.
+ * Transfer must stay valid until its status left TWI_PENDING.
+ * @return false if queue is full.
+ */
+bool twi_submit(twi_xfer_t *x)
+{
+    bool ok = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if( (uint8_t)(q_head - q_tail) < TWI_QUEUE_SIZE ) {
+            x->status = TWI_PENDING;
+            queue[q_head & TWI_QUEUE_MASK] = x;
+            ++q_head;
+            if(!busy)
+                twi_start();
+            ok = true;
+        }
+    }
+    return ok;
+}
+
+/**
+ * Abort a transfer that did not complete in time. To be called from main loop.
+ * Bus recovery busy-waits, so it runs with interrupts enabled. The TWI is off
+ * meanwhile and busy still set, so transfers submitted in between are only queued.
+ */
+void twi_poll(void)
+{
+    bool timeout = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if( busy && timer_elapsed(started) >= TWI_TIMEOUT_MS ) {
+            TWCR = 0; // no more interrupts for the aborted transfer
+            count_error(timeout);
+            timeout = true;
+        }
+    }
+    if(!timeout)
+        return;
+
+    twi_recover();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        twi_complete(TWI_TIMEOUT);
+    }
+}
+
+ISR(TWI_vect)
+{
+    twi_xfer_t *x = queue[q_tail & TWI_QUEUE_MASK];
+
+    switch(TW_STATUS) {
+        case TW_START:
+        case TW_REP_START:
+            TWDR = x->addr | (reading ? TW_READ : TW_WRITE);
+            TWCR = TWCR_NEXT;
+            break;
+
+        case TW_MT_SLA_ACK:
+            TWDR = x->reg;
+            TWCR = TWCR_NEXT;
+            break;
+
+        case TW_MT_DATA_ACK:
+            if(pos < x->wlen) {
+                TWDR = x->data[pos++];
+                TWCR = TWCR_NEXT;
+            } else if(x->rlen) {
+                reading = true;
+                pos = 0;
+                TWCR = TWCR_NEXT | (1<<TWSTA);
+            } else {
+                TWCR = TWCR_STOP;
+                twi_complete(TWI_OK);
+            }
+            break;
+
+        case TW_MR_DATA_ACK:
+            x->data[pos++] = TWDR;
+        /* fall through */
+        case TW_MR_SLA_ACK:
+            // acknowledge all but the last byte
+            TWCR = TWCR_NEXT | (pos+1 < x->rlen ? (1<<TWEA) : 0);
+            break;
+
+        case TW_MR_DATA_NACK:
+            x->data[pos] = TWDR;
+            TWCR = TWCR_STOP;
+            twi_complete(TWI_OK);
+            break;
+
+        case TW_MT_SLA_NACK:
+        case TW_MT_DATA_NACK:
+        case TW_MR_SLA_NACK:
+            count_error(nack);
+            TWCR = TWCR_STOP;
+            twi_complete(TWI_NACK);
+            break;
+
+        default: // bus error or arbitration lost
+            count_error(buserr);
+            TWCR = TWCR_STOP;
+            twi_complete(TWI_BUSERR);
+            break;
+    }
+}
+
+#endif // HAS_I2C
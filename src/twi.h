@@ -0,0 +1,70 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @file twi.h
+ *
+ * Interrupt driven TWI master working on a queue of register transfers.
+ *
+ * A transfer writes the register address and wlen data bytes, then optionally
+ * reads rlen bytes after a repeated start. Completion callbacks run in ISR
+ * context and may submit follow-up transfers. Transfers that do not finish
+ * within TWI_TIMEOUT_MS are aborted and the bus is recovered by clocking SCL.
+ */
+
+enum {
+    TWI_OK = 0,
+    TWI_PENDING,
+    TWI_NACK,
+    TWI_TIMEOUT,
+    TWI_BUSERR,
+};
+
+struct twi_xfer;
+typedef void (*twi_callback_t)(struct twi_xfer *x);
+
+typedef struct twi_xfer {
+    uint8_t  addr;          ///< 8 bit slave write address
+    uint8_t  reg;           ///< register address, always written first
+    uint8_t  wlen;          ///< data bytes to write after reg
+    uint8_t  rlen;          ///< bytes to read after repeated start, 0 for write only
+    uint8_t *data;          ///< wlen bytes to write, or room for rlen bytes read
+    twi_callback_t done;    ///< called on completion from ISR context, may be NULL
+    volatile uint8_t status;///< TWI_PENDING until completed
+} twi_xfer_t;
+
+/// Error counters, saturating at 255.
+typedef struct {
+    uint8_t nack;
+    uint8_t timeout;
+    uint8_t buserr;
+    uint8_t recovered;
+} twi_errors_t;
+
+extern volatile twi_errors_t twi_errors;
+
+void twi_queue_init(void);
+bool twi_submit(twi_xfer_t *x);
+void twi_poll(void);
+
@@ -170,7 +170,7 @@ void tr_code(char *dst, uint8_t len, uint8_t row, uint8_t col)
 }
 
 
-#ifndef __AVR__
+#if !defined(__AVR__) && !defined(HOST)
 void xor_test(const char * str)
 {
     char teststr[30];
@@ -219,5 +219,5 @@ int main(int argc, char ** argv)
         xor_test("t t t");
     }
 }
-#endif // not __AVR__
+#endif // not __AVR__ or HOST
 
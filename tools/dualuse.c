@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 
 /* DOCUMENTATION
@@ -58,14 +59,19 @@ If another key is pressed -> Dual becomes modifier immediately
 Repeat condition:
 same key just released is pressed again and then held -> if it was Dual-Use before timeout now is zero -> immetiately intepret as regular representation:
 
+A tap is only repeated if the same key is pressed again right away, any other
+key change in between forgets it, as in keyIdChange() of the firmware.
+
+Timeouts and the simulated time range are in ticks, dualuse_run() is called by
+the host build checks (tools/host/check.c) to compare the firmware against it.
+
 TODO
 ====
 -press and release timers
--cache last handled key for repeat
 
 */
 
-const char *keytype_char = "-nNMLDdrm_";
+static const char *keytype_char = "-nNMLDdrm_";
 enum keytype_t {
     invalid=0,
     normal,
@@ -88,9 +94,13 @@ enum keystatus_t {
 
 } ;
 
-uint8_t char2type(char c)
+static bool verbose; ///< print the sequence as it is evaluated
+
+#define out(...) do { if(verbose) printf(__VA_ARGS__); } while(0)
+
+static uint8_t char2type(char c)
 {
-    for(uint8_t i=0; i<sizeof(keytype_char); ++i) {
+    for(uint8_t i=0; i<strlen(keytype_char); ++i) {
         if(c==keytype_char[i])
             return i;
     }
@@ -111,22 +121,22 @@ struct keypress_t {
     uint8_t release;
 };
 
-bool isNormal(struct keypress_t kp)
+static bool isNormal(struct keypress_t kp)
 {
     return (kp.key.type == normal || kp.key.type == normal_modified);
 }
 
 #define MAX_KEYS 40
-uint8_t g_keycnt=0;
+static uint8_t g_keycnt=0;
 // sequence to analyze
-struct keypress_t seq[MAX_KEYS]; // 6 + 2 Mods is report max, but theoretically we could have more layers pressed.
+static struct keypress_t seq[MAX_KEYS]; // 6 + 2 Mods is report max, but theoretically we could have more layers pressed.
 
-uint8_t t; // time
-uint8_t pressed_keys=0;
+static uint8_t t; // time
+static uint8_t pressed_keys=0;
 
 
-uint8_t typecnt[last_type] = {} ;
-void updateStatus()
+static uint8_t typecnt[last_type] = {} ;
+static void updateStatus()
 {
     for(uint8_t i=0; i<last_type; ++i) {
         typecnt[i]=0;
@@ -137,16 +147,16 @@ void updateStatus()
         }
     }
 }
-void printStatus()
+static void printStatus()
 {
-    printf("%d|", pressed_keys);
+    out("%d|", pressed_keys);
     for(uint8_t i=1; i<last_type; ++i) {
-        printf(" %d", typecnt[i]);
+        out(" %d", typecnt[i]);
     }
-    printf("| ");
+    out("| ");
 }
 
-struct keypress_t * changed(uint8_t time, uint8_t * state) //struct keypress_t *kp)
+static struct keypress_t * changed(uint8_t time, uint8_t * state) //struct keypress_t *kp)
 {
     *state = unknown;
     for(uint8_t i=0; i<g_keycnt; ++i) {
@@ -161,24 +171,24 @@ struct keypress_t * changed(uint8_t time, uint8_t * state) //struct keypress_t *
     return NULL;
 }
 
-void printChange(struct keypress_t *kp, char state)
+static void printChange(struct keypress_t *kp, char state)
 {
-    printf("\n%3d: %*s %c%c[%c] ", t, pressed_keys*4+1, " ", state, keytype_char[kp->key.type], kp->key.display);
-    printf("%*s", (6-pressed_keys)*4, " ");
+    out("\n%3d: %*s %c%c[%c] ", t, pressed_keys*4+1, " ", state, keytype_char[kp->key.type], kp->key.display);
+    out("%*s", (6-pressed_keys)*4, " ");
     updateStatus();
     printStatus();
     if(kp->key.status == released_in_duallimit)
-        printf("dual normal release ");
+        out("dual normal release ");
     if(kp->key.status == pressed_in_repeatlimit)
-        printf("dual repeat ");
+        out("dual repeat ");
 }
 
-void duals2mods(uint8_t timeout)
+static void duals2mods(uint8_t timeout)
 {
     for(uint8_t i=0; i<g_keycnt; ++i)
         if(seq[i].key.type == dual && seq[i].key.status == pressed) {
             if(t>= seq[i].press + timeout) {
-                //printf("\n%3d: dual -> mod timeout",t);
+                //out("\n%3d: dual -> mod timeout",t);
                 seq[i].key.type = dualmod;
                 printChange(&seq[i], '.');
             }
@@ -186,45 +196,52 @@ void duals2mods(uint8_t timeout)
 }
 
 
-void main(int argc, char** argv)
+/**
+ * Evaluate a sequence of keys given as "<press><type><char><release>", e.g. "20Dr21"
+ * for a dual use key r pressed at tick 20 and released at 21, up to tick end.
+ *
+ * @param result if not NULL, receives the final type of each key as char of keytype_char
+ */
+void dualuse_run(int count, char **keys, uint8_t release_timeout, uint8_t repeat_timeout,
+                 uint8_t end, char *result)
 {
+    memset(seq, 0, sizeof(seq));
+    g_keycnt = 0;
+    verbose = !result;
 
-    for(uint8_t i=0; i< argc-1; ++i) {
+    for(uint8_t i=0; i<count && i<MAX_KEYS; ++i) {
         //uint8_t
         int p,r;
         char t,c;
-        sscanf(argv[i+1], "%d%c%c%d", &p, &t, &c, &r);
-        printf("\nRead %d = %d=%c[%c] +%2d -%2d",  i, char2type(t), t,c,p,r);
+        sscanf(keys[i], "%d%c%c%d", &p, &t, &c, &r);
+        out("\nRead %d = %d=%c[%c] +%2d -%2d",  i, char2type(t), t,c,p,r);
         struct key_t k = { .display=c, .type=char2type(t), .id=i };
         struct keypress_t kp = { .key=k,  .press=p,  .release=r };
         seq[i] = kp;
         g_keycnt=i+1;
     }
 
-    uint8_t id=0;
     /*
-       printf("\n%d keys loaded: ", g_keycnt);
+       out("\n%d keys loaded: ", g_keycnt);
        for(uint8_t i=0; i< g_keycnt; ++i){
-       printf("%c,", seq[i].key.display );
+       out("%c,", seq[i].key.display );
        }
        */
     char    state_indicator;
-    const uint8_t RELEASE_TIMEOUT = 3;
-    const uint8_t REPEAT_TIMEOUT = 3;
-    char last_released_id;
-    char last_released_dual_t;
+    char    last_tap_id=0;  // dual use key just tapped, until any other change
+    uint8_t last_tap_t=0;
 
     // header line
-    printf("\nt():         %*s#|", 6*4, " ");
+    out("\nt():         %*s#|", 6*4, " ");
     for(uint8_t i=1; i<last_type; ++i)
-        printf(" %c", keytype_char[i]);
+        out(" %c", keytype_char[i]);
 
     struct keypress_t * kp;
     pressed_keys=0;
     // loop over time
-    for(t =1; t<80; ++t) {
+    for(t =1; t<end; ++t) {
         // convert previous duals to mods if timed out.
-        duals2mods(RELEASE_TIMEOUT);
+        duals2mods(release_timeout);
         uint8_t ret;
         kp = changed(t, &ret);
         if(ret != unknown) {
@@ -238,28 +255,30 @@ void main(int argc, char** argv)
                 state_indicator = '+';
                 kp->key.status = pressed;
 
-                if(kp->key.type == dual && last_released_id==kp->key.display && t-last_released_dual_t<REPEAT_TIMEOUT) {
+                if(kp->key.type == dual && last_tap_id==kp->key.display && t-last_tap_t<repeat_timeout) {
                     // repeat as normal
                     // all previous duals are already converted at this point
                     //
                     kp->key.status = pressed_in_repeatlimit;
                     kp->key.type = dualnormalrepeat;
                 }
+                last_tap_id = 0;
             } else if( ret==released) {
-                last_released_id=kp->key.display;
+                last_tap_id = 0;
                 pressed_keys--;
                 state_indicator = '-';
                 kp->key.status = released;
 
                 if( kp->key.type == dual ) {
                     // check dual release in time
-                    if(t-kp->press<RELEASE_TIMEOUT) {
+                    if(t-kp->press<release_timeout) {
                         // convert to regular key
                         kp->key.status = released_in_duallimit;
                         kp->key.type = dualnormal;
                         // all other duals now mods
                         duals2mods(0);
-                        last_released_dual_t=t;
+                        last_tap_id=kp->key.display;
+                        last_tap_t=t;
                     }
                 }
             } else {
@@ -271,9 +290,9 @@ void main(int argc, char** argv)
             // no dual pressed, so emit pressed normals or released dualnormal
             if(typecnt[dual]==0) {
                 if(ret==pressed && ( isNormal(*kp) || kp->key.status == pressed_in_repeatlimit))
-                    printf("emit ");
+                    out("emit ");
                 if(ret==released && kp->key.type == dualnormal)
-                    printf("emit %d", kp->key.status);
+                    out("emit %d", kp->key.status);
             } else { // dual condition
 
 
@@ -281,10 +300,25 @@ void main(int argc, char** argv)
 
         }
     }
-    printf("\n");
+    out("\n");
+
+    if(result)
+        for(uint8_t i=0; i<g_keycnt; ++i)
+            result[i] = keytype_char[seq[i].key.type];
+}
+
+
+#ifndef HOST
+int main(int argc, char** argv)
+{
+    const uint8_t RELEASE_TIMEOUT = 3;
+    const uint8_t REPEAT_TIMEOUT = 3;
+
+    dualuse_run(argc-1, argv+1, RELEASE_TIMEOUT, REPEAT_TIMEOUT, 80, NULL);
+    return 0;
 }
+#endif
 
 
 
 // gcc -Werror --std=c11 dualuse.c && ./a.out 1Na3 4Lx12 5M^7 20Dr21 30Dr50 38na40 31Ds34 52Dr54 56Dr60
-
@@ -0,0 +1,1580 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/keyboard_class.h"
+#include "src/matrix.h"
+#include "src/timer.h"
+#include "src/keymap.h"
+#include "src/twi.h"
+#include "src/global_config.h"
+#include "src/macro.h"
+#ifdef NKRO
+    #include "src/Descriptors.h"
+#endif
+#include "tools/host/host.h"
+
+#undef printf // blocked for firmware code by print.h
+
+
+/* DOCUMENTATION
+
+Self checks of the firmware core on the simulated board, run with "adnw_host -t"
+or "make check". Each check prints its name and "ok", or what went wrong and
+"FAILED". Checks that only concern the matrix take the place of the main loop
+and pop the key events themselves.
+*/
+
+
+/// Debounced key event queue size in matrix.c
+#define EVENT_QUEUE_SIZE 16
+/// Tap repeat timeout [ms] in keyboard_class.c
+#define TAP_TIMEOUT_REPEAT 160
+
+void keyIdChange(uint8_t row, uint8_t col, uint8_t change, uint16_t time);
+uint8_t getActiveLayer(void);
+
+/**
+ * One scan: a scan timer period of millisecond ticks, then the scan itself.
+ * On I2C boards the main loop debounces the rows read by the transfers queued in
+ * its previous call, so the bus runs first until all rows were read once.
+ */
+static void scan_once(void)
+{
+#ifdef MATRIX_SCAN_IN_ISR
+    for(uint8_t i=0; i<1000/MATRIX_SCAN_HZ; ++i)
+        TIMER0_COMPA_vect();
+    scan_matrix();
+#else
+    uint32_t reads = host_i2c.row_reads;
+    do {
+        do {
+            TIMER0_COMPA_vect();
+            host_i2c_run(1000);
+        } while(!host_i2c_idle());
+        scan_matrix();
+    } while(host_i2c.row_reads - reads < ROWS); // idle mode reads both halves at once
+#endif
+}
+
+static void press_all(bool down)
+{
+    for(uint8_t r=0; r<ROWS; ++r)
+        host_matrix[r] = down ? (column_size_t)(~(column_size_t)0) >> (8*sizeof(column_size_t) - COLS) : 0;
+}
+
+/// Key state as seen by the consumer of the event queue, with sanity checks of each event.
+typedef struct {
+    bool     down[ROWS][COLS];
+    uint16_t last;      ///< time of the previous event
+    bool     started;
+    uint32_t presses, releases, holds;
+    bool     ok;
+} event_model_t;
+
+static void event_apply(event_model_t *m, const keyevent_t *ev)
+{
+    uint8_t row = ev->id >> 4, col = ev->id & 0x0F;
+
+    if(row >= ROWS || col >= COLS) {
+        printf("  event for invalid key %02X\n", ev->id);
+        m->ok = false;
+        return;
+    }
+    if(m->started && (int16_t)(ev->time - m->last) < 0) {
+        printf("  event %02X at %u before previous one at %u\n", ev->id, ev->time, m->last);
+        m->ok = false;
+    }
+    m->started = true;
+    m->last    = ev->time;
+
+    bool *down = &m->down[row][col];
+    switch(ev->change) {
+    case KEY_PRESS:
+        ++m->presses;
+        if(*down) {
+            printf("  key %02X pressed twice\n", ev->id);
+            m->ok = false;
+        }
+        *down = true;
+        break;
+    case KEY_RELEASE:
+        ++m->releases;
+        if(!*down) {
+            printf("  key %02X released twice\n", ev->id);
+            m->ok = false;
+        }
+        *down = false;
+        break;
+    case KEY_HOLD:
+        ++m->holds;
+        if(!*down) {
+            printf("  hold of released key %02X\n", ev->id);
+            m->ok = false;
+        }
+        break;
+    default:
+        printf("  invalid change %u of key %02X\n", ev->change, ev->id);
+        m->ok = false;
+    }
+}
+
+/// Pop up to max events into the model, returns the number of presses and releases.
+static uint16_t event_drain(event_model_t *m, uint16_t max)
+{
+    keyevent_t ev;
+    uint16_t n = 0, changes = 0;
+
+    while(n < max && matrix_pop_event(&ev)) {
+        event_apply(m, &ev);
+        if(ev.change != KEY_HOLD)
+            ++changes;
+        ++n;
+    }
+    return changes;
+}
+
+/// Scan and pop until no more keys change, i.e. the debounced state follows host_matrix.
+static void event_settle(event_model_t *m)
+{
+    for(uint8_t quiet=0; quiet < 32; ) {
+        scan_once();
+        quiet = event_drain(m, 0xFFFF) ? 0 : quiet+1;
+    }
+}
+
+static bool event_compare(event_model_t *m)
+{
+    for(uint8_t r=0; r<ROWS; ++r)
+        for(uint8_t c=0; c<COLS; ++c)
+            if(m->down[r][c] != !!(host_matrix[r] & ((column_size_t)1 << c))) {
+                printf("  key %X%X %s, but not reported\n", r, c, m->down[r][c] ? "released" : "pressed");
+                m->ok = false;
+            }
+    return m->ok;
+}
+
+/**
+ * Key event queue between scan and main loop: a full queue must delay events but
+ * never lose, duplicate or reorder them, whatever the interleaving of scans and pops.
+ */
+static bool check_event_queue(void)
+{
+    event_model_t m = { .ok = true };
+
+    press_all(false);
+    event_settle(&m);
+    memset(&m, 0, sizeof(m));
+    m.ok = true;
+
+    // all keys at once without popping: as many whole rows as fit, in scan order
+    press_all(true);
+    for(uint8_t i=0; i<8; ++i)
+        scan_once();
+
+    keyevent_t ev;
+    uint16_t n = 0;
+    int16_t prev = -1;
+    while(matrix_pop_event(&ev)) {
+        if(ev.change != KEY_PRESS || ev.id <= prev) {
+            printf("  overflow: event %u is %02X/%u after %02X\n", n, ev.id, ev.change, prev);
+            m.ok = false;
+        }
+        prev = ev.id;
+        event_apply(&m, &ev);
+        ++n;
+    }
+    if(n != EVENT_QUEUE_SIZE/COLS*COLS) {
+        printf("  overflow: %u events queued, expected %u\n", n, EVENT_QUEUE_SIZE/COLS*COLS);
+        m.ok = false;
+    }
+    // the rest follows once there is room again
+    event_settle(&m);
+    if(!event_compare(&m) || m.presses != ROWS*COLS) {
+        printf("  overflow: %u of %u presses\n", m.presses, ROWS*COLS);
+        return false;
+    }
+    press_all(false);
+    event_settle(&m);
+    if(!event_compare(&m) || m.releases != ROWS*COLS) {
+        printf("  overflow: %u of %u releases\n", m.releases, ROWS*COLS);
+        return false;
+    }
+
+    // random typing with the consumer falling behind at times
+    srand(1);
+    for(uint32_t scan=1; scan <= 20000; ++scan) {
+        if(rand() % 4 == 0) {
+            uint8_t r = rand() % ROWS, c = rand() % COLS;
+            host_matrix[r] ^= (column_size_t)1 << c;
+        }
+        event_drain(&m, rand() % 4);
+        scan_once();
+
+        if(scan % 1000 == 0) {
+            event_settle(&m);
+            if(!event_compare(&m))
+                return false;
+        }
+    }
+    press_all(false);
+    event_settle(&m);
+    if(!event_compare(&m))
+        return false;
+
+    printf("  %u presses, %u releases, %u repeats\n", m.presses, m.releases, m.holds);
+    return m.ok;
+}
+
+/**
+ * Recorded bounce traces, one character per scan: raw switch state, and the expected
+ * events per engine, indexed by DEBOUNCE. '.' for none, P for press, R for release.
+ */
+static const struct {
+    const char *raw;
+    const char *events[3];  ///< DEFER, EAGER, ASYM
+} bounce_traces[] = {
+    { "0101111111111111010000000000",
+    { "......P..............R......",     // 4 identical scans each
+      ".P..............R...........",     // first edges, bounces within lockout
+      ".P...................R......" } }, // first edge, then 4 identical scans
+    { "000100000000",
+    { "............",                     // spike ignored
+      "...P...R....",                     // spike reported, release after lockout
+      "...P...R...." } },
+    { "0011101111000011101111011110000000",
+    { ".........P...R.......P........R...",  // chatter restarts the count
+      "..P.......R...P.......R...P...R...",  // chatter after lockout passes
+      "..P..........RP...............R..." } },
+};
+
+static const char *debounce_names[] = { "DEFER", "EAGER", "ASYM" };
+
+/**
+ * Debounce engines: bounce traces on all keys at once, each key delayed by a few
+ * scans against its neighbours, so every column bit of the word is checked on its own.
+ */
+static bool check_bounce(void)
+{
+    event_model_t m = { .ok = true };
+    bool ok = true;
+
+    printf("  %s engine, %u columns in %u bit words\n", debounce_names[DEBOUNCE], COLS, 8*(unsigned)sizeof(column_size_t));
+    for(uint8_t t=0; t<sizeof(bounce_traces)/sizeof(bounce_traces[0]); ++t) {
+        const char *raw = bounce_traces[t].raw, *expected = bounce_traces[t].events[DEBOUNCE];
+        uint8_t len = strlen(raw);
+        char seen[ROWS][COLS][64];
+
+        press_all(false);
+        event_settle(&m);
+        memset(seen, '.', sizeof(seen));
+
+        for(uint8_t scan=0; scan < len+7; ++scan) {
+            for(uint8_t r=0; r<ROWS; ++r)
+                for(uint8_t c=0; c<COLS; ++c) {
+                    int8_t i = scan - (r*COLS+c) % 7;
+                    column_size_t mask = (column_size_t)1 << c;
+                    if(i >= 0 && i < len && raw[i] == '1')
+                        host_matrix[r] |=  mask;
+                    else
+                        host_matrix[r] &= ~mask;
+                }
+            scan_once();
+
+            keyevent_t ev;
+            while(matrix_pop_event(&ev)) {
+                event_apply(&m, &ev);
+                uint8_t r = ev.id >> 4, c = ev.id & 0x0F;
+                int8_t i = scan - (r*COLS+c) % 7;
+                if(ev.change != KEY_HOLD && i >= 0 && i < len)
+                    seen[r][c][i] = ev.change == KEY_PRESS ? 'P' : 'R';
+            }
+        }
+        for(uint8_t r=0; r<ROWS; ++r)
+            for(uint8_t c=0; c<COLS; ++c)
+                if(memcmp(seen[r][c], expected, len) != 0) {
+                    printf("  trace %u, key %X%X:\n    raw      %s\n    expected %s\n    seen     %.*s\n",
+                           t, r, c, raw, expected, len, seen[r][c]);
+                    ok = false;
+                    r = ROWS;
+                    break;
+                }
+    }
+    return ok && m.ok;
+}
+
+/// Run the whole firmware for ms milliseconds, see host_tick().
+static void ticks(uint16_t ms)
+{
+    while(ms--)
+        host_tick();
+}
+
+static void key(uint8_t row, uint8_t col, bool down)
+{
+    if(down)
+        host_matrix[row] |=  (column_size_t)1 << col;
+    else
+        host_matrix[row] &= ~((column_size_t)1 << col);
+}
+
+/// Position of an unmodified key with usage hid in layer 0, false if none.
+static bool find_key(uint8_t hid, uint8_t *row, uint8_t *col)
+{
+    for(uint8_t r=0; r<ROWS; ++r)
+        for(uint8_t c=0; c<COLS; ++c) {
+            keycode k = getKeyStruct(r, c, 0);
+            if(k.hid == hid && k.mods == 0) {
+                *row = r;
+                *col = c;
+                return true;
+            }
+        }
+    return false;
+}
+
+static bool report_has(uint8_t hid)
+{
+    for(uint8_t i=0; i<host_report.count; ++i)
+        if(host_report.keys[i] == hid)
+            return true;
+    return false;
+}
+
+static bool report_empty(void)
+{
+    for(uint8_t i=0; i<host_report.count; ++i)
+        if(host_report.keys[i])
+            return false;
+    return host_report.mod == 0;
+}
+
+static void print_last_report(void)
+{
+    printf("  report %02X:", host_report.mod);
+    for(uint8_t i=0; i<host_report.count; ++i)
+        printf(" %02X", host_report.keys[i]);
+    printf("\n");
+}
+
+/**
+ * Every key of the matrix down at once, then up again: all keys are tracked without a
+ * limit, and the keyboard is back to empty reports and normal typing afterwards.
+ */
+static bool check_all_keys(void)
+{
+    bool ok = true;
+    uint8_t row, col;
+
+    press_all(false);
+    ticks(1000);
+
+    press_all(true);
+    ticks(2000);
+    if(activeKeysCount() != ROWS*COLS) {
+        printf("  %u of %u keys down\n", activeKeysCount(), ROWS*COLS);
+        ok = false;
+    }
+    press_all(false);
+    ticks(2000);
+    if(activeKeysCount() != 0 || !report_empty()) {
+        printf("  %u keys still down after release\n", activeKeysCount());
+        print_last_report();
+        ok = false;
+    }
+
+    if(!find_key(HID_A, &row, &col))
+        return ok;
+    key(row, col, true);
+    ticks(100);
+    if(!report_has(HID_A)) {
+        printf("  key A not typed afterwards\n");
+        print_last_report();
+        ok = false;
+    }
+    key(row, col, false);
+    ticks(100);
+    return ok && report_empty();
+}
+
+static uint16_t clock_fired;  ///< timer_read() when clock_event() ran
+
+static void clock_event(void)
+{
+    clock_fired = timer_read();
+}
+
+/// Advance the clock stub by one millisecond and run due events, without busy waits.
+static void clock_ms(void)
+{
+    TIMER0_COMPA_vect();
+    timer_task();
+}
+
+/**
+ * Millisecond clock and timed events across the wrap of the 16 bit counter, and
+ * the LED blink pattern derived from it.
+ */
+static bool check_clock(void)
+{
+    bool ok = true;
+    uint16_t saved = timer_ms;
+
+    timer_ms = 0xFFF0;
+    uint16_t start = timer_read(), seconds = timer_read_s();
+    clock_fired = 0;
+    timer_schedule(40, clock_event);
+    for(uint16_t i=0; i<1000; ++i) {
+        if(i == 32 && timer_elapsed(start) != 32) {
+            printf("  %u ms elapsed across wrap instead of 32\n", timer_elapsed(start));
+            ok = false;
+        }
+        clock_ms();
+    }
+    if(clock_fired != (uint16_t)(start + 40) || timer_pending(clock_event)) {
+        printf("  event due at %04X ran at %04X\n", (uint16_t)(start + 40), clock_fired);
+        ok = false;
+    }
+    if(timer_elapsed_s(seconds) != 1) {
+        printf("  %u s for 1000 ms\n", timer_elapsed_s(seconds));
+        ok = false;
+    }
+
+#ifdef HAS_LED
+    // on 3 steps, off 5+1 steps of 16 ms: each run is 48 ms lit and 96 ms dark
+    led_t led = g_cfg.led;
+    uint16_t run = 0, runs = 0;
+    bool lit = led_blink();
+
+    g_cfg.led.on  = 3;
+    g_cfg.led.off = 5;
+    timer_ms = 0xF000;
+    for(uint16_t i=0; i<0x2000; ++i) {
+        clock_ms();
+        ++run;
+        if(led_blink() == lit)
+            continue;
+        if(runs++ > 1 && run != (lit ? 48 : 96)) {
+            printf("  LED %s for %u ms at %04X\n", lit ? "on" : "off", run, timer_read());
+            ok = false;
+        }
+        lit = !lit;
+        run = 0;
+    }
+    g_cfg.led = led;
+#endif
+    timer_ms = saved;
+    return ok;
+}
+
+/// Unmodified letters of layer 0 that are neither layer nor modifier keys.
+static uint8_t plain_keys(uint8_t keys[][2], uint8_t max)
+{
+    uint8_t n = 0;
+
+    for(uint8_t r=0; r<ROWS && n<max; ++r)
+        for(uint8_t c=0; c<COLS && n<max; ++c) {
+            keycode k = getKeyStruct(r, c, 0);
+            if(k.hid >= HID_A && k.hid <= HID_Z && k.mods == 0) {
+                keys[n][0] = r;
+                keys[n][1] = c;
+                ++n;
+            }
+        }
+    return n;
+}
+
+/**
+ * Cost of one report with 1 to 10 keys held: fillKeyboardReport() may read each
+ * key that ends up in the report once from flash, but nothing else.
+ * Host time per report is printed for comparison between builds.
+ */
+static bool check_lookup(void)
+{
+    enum { MAX_HELD = 10, RUNS = 20000 };
+    uint8_t keys[MAX_HELD][2];
+    uint8_t n = plain_keys(keys, MAX_HELD);
+    bool ok = true;
+
+    press_all(false);
+    ticks(1000);
+    for(uint8_t held=1; held<=n; ++held) {
+        USB_KeyboardReport_Data_t report;
+        struct timespec t0, t1;
+
+        key(keys[held-1][0], keys[held-1][1], true);
+        ticks(200);
+
+        uint32_t reads = host_flash_reads;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(unsigned i=0; i<RUNS; ++i) {
+            memset(&report, 0, sizeof(report));
+            fillKeyboardReport(&report);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        reads = (host_flash_reads - reads) / RUNS;
+
+        uint8_t in_report = 0;
+        for(uint8_t i=0; i<6; ++i)
+            in_report += report.KeyCode[i] != 0;
+        double ns = ((t1.tv_sec - t0.tv_sec)*1e9 + (t1.tv_nsec - t0.tv_nsec)) / RUNS;
+        printf("  %2u keys held: %u flash reads, %.0f ns per report\n", held, reads, ns);
+
+        if(reads > held || reads < in_report || in_report != (held < 6 ? held : 6))
+            ok = false;
+    }
+    press_all(false);
+    ticks(1000);
+    return ok && n == MAX_HELD;
+}
+
+/// Key of a dual use sequence in ticks of DUAL_TICK, see tools/dualuse.c
+typedef struct {
+    uint8_t row, col;
+    uint8_t press, release;
+    bool    dual;
+} dual_key_t;
+
+#define DUAL_TICK 10    ///< ms per tick of the model
+
+/// First tick from t on that has no event yet.
+static uint8_t dual_free_tick(bool used[256], uint8_t t)
+{
+    while(used[t])
+        ++t;
+    used[t] = true;
+    return t;
+}
+
+/**
+ * Decisions of the firmware for the dual use keys of a sequence, events are passed
+ * to keyIdChange() directly with their exact time, as busy waits advance the clock
+ * beyond host_tick(). A pressed key is held ('m') if its modifier is reported,
+ * tapped ('d') if its tap is reported after its release, and repeated ('r') if the
+ * tap is reported while it is held.
+ */
+static void dual_firmware(const dual_key_t *keys, uint8_t n, uint8_t end, uint8_t tab, char *result)
+{
+    int8_t   current = -1;  // last pressed dual use key
+    bool     down = false;
+    uint16_t base = timer_read();
+    uint8_t  next = 1;      // tick of the next events
+
+    for(uint8_t i=0; i<n; ++i)
+        result[i] = keys[i].dual ? 'D' : 'n';
+
+    while(next < end) {
+        for(; next < end && next*DUAL_TICK <= timer_elapsed(base); ++next) {
+            uint16_t time = base + next*DUAL_TICK;
+            for(uint8_t i=0; i<n; ++i) {
+                if(keys[i].press == next) {
+                    keyIdChange(keys[i].row, keys[i].col, KEY_PRESS, time);
+                    if(keys[i].dual) {
+                        current = i;
+                        down = true;
+                    }
+                }
+                if(keys[i].release == next) {
+                    keyIdChange(keys[i].row, keys[i].col, KEY_RELEASE, time);
+                    if(keys[i].dual)
+                        down = false;
+                }
+            }
+        }
+        host_tick();
+
+        if(current < 0 || result[current] != 'D')
+            continue;
+        if(report_has(tab))
+            result[current] = down ? 'r' : 'd';
+        else if(host_report.mod & (1<<(MOD_L_CTRL-MOD_FIRST)))
+            result[current] = 'm';
+    }
+}
+
+/**
+ * Report rebuilds while typing: polls without a key change return the cached
+ * report, so a rebuild is only expected for each press and release.
+ * Typing is simulated at 8 keys/s with rolled over presses of 40-160 ms.
+ */
+static bool check_rebuilds(void)
+{
+    enum { SECONDS = 20, KEYS = 8 };
+    uint8_t keys[KEYS][2];
+    uint8_t n = plain_keys(keys, KEYS);
+    uint16_t release[KEYS] = { 0 };
+    uint32_t changes = 0;
+
+    press_all(false);
+    ticks(1000);
+    srand(1);
+    uint32_t builds = host_report_builds;
+    for(uint16_t ms=1; ms<=SECONDS*1000; ++ms) {
+        if(ms % 125 == 0) {
+            uint8_t k = rand() % n;
+            if(!release[k]) {
+                key(keys[k][0], keys[k][1], true);
+                release[k] = ms + 40 + rand() % 120;
+                ++changes;
+            }
+        }
+        for(uint8_t k=0; k<n; ++k)
+            if(release[k] == ms) {
+                key(keys[k][0], keys[k][1], false);
+                release[k] = 0;
+                ++changes;
+            }
+        host_tick();
+    }
+    press_all(false);
+    ticks(1000);
+    builds = host_report_builds - builds;
+
+    printf("  %u key changes/s: %u of 1000 reports/s rebuilt\n",
+           changes/SECONDS, builds/SECONDS);
+
+    // held keys alone do not rebuild
+    key(keys[0][0], keys[0][1], true);
+    ticks(100);
+    uint32_t held = host_report_builds;
+    ticks(1000);
+    held = host_report_builds - held;
+    key(keys[0][0], keys[0][1], false);
+    ticks(100);
+    if(held)
+        printf("  %u rebuilds while a key was held\n", held);
+
+    return builds <= changes + 2 && !held;
+}
+
+/**
+ * A key pressed and released while a macro plays back is reported once playback ends,
+ * as no report held it before its release.
+ */
+static bool check_macro_overlap(void)
+{
+    uint8_t keys[2][2], row, col;
+    uint8_t n = plain_keys(keys, 2);
+    bool seen = false;
+
+    if(n < 2)
+        return false;
+    row = keys[0][0];
+    col = keys[0][1];
+    if(getKeyStruct(row, col, 0).hid == HID_B) {
+        row = keys[1][0];
+        col = keys[1][1];
+    }
+    uint8_t hid = getKeyStruct(row, col, 0).hid;
+
+    press_all(false);
+    ticks(1000);
+    setMacroRecording('o', 0, 0);
+    for(uint8_t i=0; i<30; ++i)
+        macro_key(HID_B, 0);
+    macro_key(HID_ENTER, HID_MOD_MASK(MOD_L_CTRL));
+    if(!printMacro('o')) {
+        printf("  macro not recorded\n");
+        return false;
+    }
+
+    for(uint16_t ms=0; ms<1000; ++ms) {
+        if(ms == 5 || ms == 25)
+            key(row, col, ms == 5);
+        host_tick();
+        seen |= report_has(hid);
+    }
+    if(!seen)
+        printf("  key %02X pressed during playback never reported\n", hid);
+    return seen && report_empty();
+}
+
+/// Keys of a layer reached by a momentary or dual use layer key, by implicit modifier.
+typedef struct {
+    uint8_t layer_row, layer_col;
+    uint8_t row[3], col[3];     ///< with AltGr, with Shift, without
+    uint8_t hid[3], mod[3];
+} implicit_keys_t;
+
+static bool find_implicit_keys(implicit_keys_t *ik)
+{
+    const uint8_t mods[3] = { ALTGR, SHIFT, 0 };
+
+    for(uint8_t lr=0; lr<ROWS; ++lr)
+        for(uint8_t lc=0; lc<COLS; ++lc) {
+            uint8_t m = getKeyStruct(lr, lc, 0).mods;
+            uint8_t layer = m & 0x0F;
+            if( !(m & LAYER_MASK) || (m & (LAYER_TOGGLE|LAYER_ONESHOT))
+                || !layer || layer >= LAYERS || m == MOD_MOUSEKEY )
+                continue;
+
+            uint8_t found = 0;
+            for(uint8_t i=0; i<3; ++i)
+                for(uint8_t r=0; r<ROWS && !(found & (1<<i)); ++r)
+                    for(uint8_t c=0; c<COLS && !(found & (1<<i)); ++c) {
+                        keycode k = getKeyStruct(r, c, layer);
+                        if(k.mods != mods[i] || k.hid == HID_NO_KEY || k.hid == HID_TRANSPARENT
+                           || k.hid > HID_APPLICATION || getKeyStruct(r, c, 0).mods != 0)
+                            continue;
+                        ik->row[i] = r;
+                        ik->col[i] = c;
+                        ik->hid[i] = k.hid;
+                        ik->mod[i] = mods[i] ? 1<<(mods[i]&0x0F) : 0;
+                        found |= 1<<i;
+                    }
+            if(found == 7) {
+                ik->layer_row = lr;
+                ik->layer_col = lc;
+                return true;
+            }
+        }
+    return false;
+}
+
+/**
+ * Rolls of keys with different implicit modifiers, e.g. "@" as AltGr+Q followed
+ * by a plain key: every key must first appear in a report with its own implicit
+ * modifier, and must appear at all while held. All orders of two and three keys
+ * are pressed within the same scan or 20 ms apart, held on the layer that has them.
+ * A dual use layer key is held beyond its tapping term first.
+ */
+static bool check_implicit_rolls(void)
+{
+    static const uint8_t orders[][3] = {
+        {0,1,9}, {1,0,9}, {0,2,9}, {2,0,9}, {1,2,9}, {2,1,9},
+        {0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0},
+    };
+    implicit_keys_t ik;
+    unsigned failed = 0, rolls = 0;
+
+    if(!find_implicit_keys(&ik)) {
+        printf("  no layer with AltGr, Shift and plain keys\n");
+        return true;
+    }
+
+    press_all(false);
+    ticks(1000);
+    for(uint8_t o=0; o<sizeof(orders)/sizeof(orders[0]); ++o)
+        for(uint8_t gap=0; gap<=20; gap+=20) {
+            uint8_t n = orders[o][2] < 3 ? 3 : 2;
+            bool seen[3] = { false };
+            host_report_t prev;
+            bool ok = true;
+
+            key(ik.layer_row, ik.layer_col, true);
+            ticks(600);
+            prev = host_report;
+            for(uint16_t ms=0; ms<n*gap+200; ++ms) {
+                for(uint8_t i=0; i<n; ++i) {
+                    uint8_t k = orders[o][i];
+                    if(ms == i*gap)
+                        key(ik.row[k], ik.col[k], true);
+                    if(ms == n*gap + 100 + 20*i)
+                        key(ik.row[k], ik.col[k], false);
+                }
+                host_tick();
+                if(!memcmp(&prev, &host_report, sizeof(prev)))
+                    continue;
+                for(uint8_t k=0; k<3; ++k) {
+                    bool now = report_has(ik.hid[k]), before = false;
+                    for(uint8_t j=0; j<prev.count; ++j)
+                        before |= prev.keys[j] == ik.hid[k];
+                    if(now && !before) {
+                        seen[k] = true;
+                        ok &= host_report.mod == ik.mod[k];
+                    }
+                }
+                prev = host_report;
+            }
+            for(uint8_t i=0; i<n; ++i)
+                ok &= seen[orders[o][i]];
+            key(ik.layer_row, ik.layer_col, false);
+            ticks(200);
+
+            ++rolls;
+            if(!ok && failed++ < 5)
+                printf("  roll %u%u%c %u ms apart failed\n", orders[o][0], orders[o][1],
+                       n == 3 ? '0'+orders[o][2] : ' ', gap);
+        }
+    printf("  %u rolls of keys %02X+%02X, %02X+%02X, %02X: %u failed\n", rolls,
+           ik.hid[0], ik.mod[0], ik.hid[1], ik.mod[1], ik.hid[2], failed);
+    return !failed;
+}
+
+/// Key change at ms of a key in the table of the check.
+typedef struct {
+    uint16_t ms;
+    uint8_t  key;
+    bool     down;
+} timed_event_t;
+
+/**
+ * Pass the events to keyIdChange() at their exact time and collect the keys in
+ * the order they are first reported, until 200 ms after the last event.
+ */
+static uint8_t replay_events(const timed_event_t *ev, uint8_t n, uint8_t keys[][2],
+                             uint8_t *seen, uint8_t max)
+{
+    uint16_t base = timer_read();
+    uint8_t  count = 0;
+
+    for(uint8_t i=0; i<n || timer_elapsed(base) < ev[n-1].ms + 200; ) {
+        for(; i<n && ev[i].ms <= timer_elapsed(base); ++i)
+            keyIdChange(keys[ev[i].key][0], keys[ev[i].key][1],
+                        ev[i].down ? KEY_PRESS : KEY_RELEASE, base + ev[i].ms);
+        host_tick();
+
+        for(uint8_t k=0; k<host_report.count; ++k) {
+            uint8_t hid = host_report.keys[k], j = 0;
+            while(j<count && seen[j] != hid)
+                ++j;
+            if(hid && j == count && count < max)
+                seen[count++] = hid;
+        }
+    }
+    return count;
+}
+
+/**
+ * Combo windows, on a table of combos a+b in 50 ms (default), a+b+c in 80 ms and
+ * d+e in 20 ms: the combo key is sent for presses within the window in any order,
+ * and the keys themselves in their order otherwise. A longer combo waits for its
+ * last key, one key released releases the combo.
+ */
+static bool check_combos(void)
+{
+    enum { A, B, C, D, E, X, KEYS };
+    static const struct {
+        const char   *name;
+        timed_event_t ev[6];
+        const char   *expect;   ///< keys A.. as 'a'.., combos as '1'..
+    } cases[] = {
+        { "a+b 30 ms",          { {0,A,1}, {30,B,1},  {200,A,0}, {210,B,0} },             "1" },
+        { "b+a 10 ms",          { {0,B,1}, {10,A,1},  {200,A,0}, {210,B,0} },             "1" },
+        { "a+b 60 ms",          { {0,A,1}, {60,B,1},  {200,A,0}, {210,B,0} },             "ab" },
+        { "a+b+c 70 ms",        { {0,A,1}, {30,B,1},  {70,C,1},  {200,A,0}, {210,B,0}, {220,C,0} }, "2" },
+        { "a+b, c at 90 ms",    { {0,A,1}, {30,B,1},  {90,C,1},  {200,A,0}, {210,B,0}, {220,C,0} }, "1c" },
+        { "d+e 15 ms",          { {0,D,1}, {15,E,1},  {200,D,0}, {210,E,0} },             "3" },
+        { "d+e 25 ms",          { {0,D,1}, {25,E,1},  {200,D,0}, {210,E,0} },             "de" },
+        { "a then x",           { {0,A,1}, {10,X,1},  {200,A,0}, {210,X,0} },             "ax" },
+        { "a+b, a released",    { {0,A,1}, {10,B,1},  {150,A,0}, {400,B,0} },             "1" },
+    };
+    uint8_t keys[KEYS][2];
+
+    if(plain_keys(keys, KEYS) < KEYS)
+        return false;
+    keycode k[KEYS];
+    for(uint8_t i=0; i<KEYS; ++i)
+        k[i] = getKeyStruct(keys[i][0], keys[i][1], 0);
+    ComboKeys[0] = (combo_t) { { k[A], k[B] },       { HID_F1, 0 }, 0 };
+    ComboKeys[1] = (combo_t) { { k[A], k[B], k[C] }, { HID_F2, 0 }, 80 };
+    ComboKeys[2] = (combo_t) { { k[D], k[E] },       { HID_F3, 0 }, 20 };
+
+    bool ok = true;
+    press_all(false);
+    ticks(1000);
+    for(uint8_t c=0; c<sizeof(cases)/sizeof(cases[0]); ++c) {
+        uint8_t n = 0, seen[8], count;
+        while(n < 6 && (n == 0 || cases[c].ev[n].ms))
+            ++n;
+        count = replay_events(cases[c].ev, n, keys, seen, sizeof(seen));
+
+        char got[9];
+        for(uint8_t i=0; i<count; ++i) {
+            got[i] = '?';
+            for(uint8_t j=0; j<KEYS; ++j)
+                if(seen[i] == k[j].hid)
+                    got[i] = j == X ? 'x' : 'a'+j;
+            if(seen[i] >= HID_F1 && seen[i] <= HID_F3)
+                got[i] = '1' + seen[i] - HID_F1;
+        }
+        got[count] = 0;
+        if(strcmp(got, cases[c].expect) || !report_empty()) {
+            printf("  %s: reported \"%s\" instead of \"%s\"\n", cases[c].name, got, cases[c].expect);
+            ok = false;
+        }
+        ticks(500);
+    }
+    memset(ComboKeys, 0, sizeof(ComboKeys));
+    return ok;
+}
+
+/// Tap the key, first usage reported while it is held as 'x'/'y' for keys[X]/[Y], '5'-'7' for F5-F7.
+static char tap_layer_key(const keycode *k, const uint8_t (*pos)[2])
+{
+    char got = '-';
+
+    key(pos[0][0], pos[0][1], true);
+    ticks(50);
+    for(uint8_t i=0; i<host_report.count; ++i) {
+        uint8_t hid = host_report.keys[i];
+        if(hid == k[0].hid)
+            got = 'x';
+        else if(hid == k[1].hid)
+            got = 'y';
+        else if(hid >= HID_F5 && hid <= HID_F7)
+            got = '5' + hid - HID_F5;
+    }
+    key(pos[0][0], pos[0][1], false);
+    ticks(50);
+    return got;
+}
+
+/**
+ * Layer stack with a held layer 1 key, a layer 3 toggle and a layer 2 one-shot key.
+ * X is F7 in layer 1, F6 in layer 2 and transparent in layer 3, Y is F5 in layer 3
+ * and transparent in layers 1 and 2. Transparent entries fall through to the next
+ * lower active layer only, a one-shot layer ends with the release of the next key.
+ * The board keymap is changed for this through the flash patches of the memcpy_P() mock.
+ */
+static bool check_layers(void)
+{
+#if LAYERS < 4
+    printf("  needs 4 layers\n");
+    return true;
+#else
+    enum { X, Y, T, O, M, KEYS };
+    static const struct {
+        const char *name;
+        const char *seq;        ///< taps of x, y, t, o; M and m press and release M
+        const char *expect;     ///< reported per tap of x or y
+    } cases[] = {
+        { "layer 0",            "xy",   "xy" },
+        { "held 1",             "Mxym", "7y" },
+        { "toggle 3 on",        "tyxy", "5x5" },
+        { "held 1 over 3",      "Mxym", "75" },
+        { "one-shot 2 over 3",  "oxx",  "6x" },
+        { "toggle 3 off",       "tyx",  "yx" },
+        { "one-shot 2",         "oxx",  "6x" },
+        { "one-shot 2 to 0",    "oyx",  "yx" },
+    };
+    static const struct {
+        uint8_t layer, key;
+        keycode kc;
+    } patches[] = {
+        { 0, T, _TOGGLE(3) },
+        { 0, O, _ONESHOT(2) },
+        { 0, M, _MOD_1 },
+        { 1, X, _F7 },
+        { 2, X, _F6 },
+        { 3, X, _trns },
+        { 1, Y, _trns },
+        { 2, Y, _trns },
+        { 3, Y, _F5 },
+    };
+    uint8_t plain[ROWS*COLS][2], keys[KEYS][2], xy = X, other = T;
+    uint8_t count = plain_keys(plain, ROWS*COLS);
+    keycode k[2];
+
+    // X and Y need entries in layers 1-3 to patch, which a packed keymap may leave out
+    for(uint8_t i=0; i<count; ++i) {
+        bool stored = true;
+        for(uint8_t l=1; l<4; ++l) {
+            keycode kc = getKeyStruct(plain[i][0], plain[i][1], l);
+            stored &= kc.hid || kc.mods;
+        }
+        if(stored && xy <= Y)
+            memcpy(keys[xy++], plain[i], 2);
+        else if(other < KEYS)
+            memcpy(keys[other++], plain[i], 2);
+    }
+    if(xy <= Y || other < KEYS) {
+        printf("  no keys for the layer check\n");
+        return false;
+    }
+    k[X] = getKeyStruct(keys[X][0], keys[X][1], 0);
+    k[Y] = getKeyStruct(keys[Y][0], keys[Y][1], 0);
+
+    // keymap entries are changed where memcpy_P() reads them from flash
+    for(uint8_t i=0; i<sizeof(patches)/sizeof(patches[0]); ++i) {
+        getKeyStruct(keys[patches[i].key][0], keys[patches[i].key][1], patches[i].layer);
+        host_flash_patch(host_flash_last, &patches[i].kc, sizeof(keycode));
+    }
+
+    bool ok = true;
+    press_all(false);
+    ticks(1000);
+    for(uint8_t c=0; c<sizeof(cases)/sizeof(cases[0]); ++c) {
+        char got[8];
+        uint8_t n = 0;
+        for(const char *s=cases[c].seq; *s; ++s) {
+            uint8_t i = *s == 'x' ? X : *s == 'y' ? Y : *s == 't' ? T : *s == 'o' ? O : M;
+            if(*s == 'M' || *s == 'm') {
+                key(keys[M][0], keys[M][1], *s == 'M');
+                ticks(50);
+            } else if(i <= Y) {
+                got[n++] = tap_layer_key(k, &keys[i]);
+            } else {
+                tap_layer_key(k, &keys[i]);
+            }
+        }
+        got[n] = 0;
+        if(strcmp(got, cases[c].expect)) {
+            printf("  %s: reported \"%s\" instead of \"%s\"\n", cases[c].name, got, cases[c].expect);
+            ok = false;
+        }
+    }
+    if(getActiveLayer() != 0 || !report_empty()) {
+        printf("  layer %u active at the end\n", getActiveLayer());
+        ok = false;
+    }
+    host_flash_unpatch();
+    return ok;
+#endif
+}
+
+#ifdef STENO
+/// Position of a steno key in StenoMatrix[], false if it has none.
+static bool find_steno_key(uint8_t key, uint8_t *row, uint8_t *col)
+{
+    for(uint8_t r=0; r<ROWS; ++r)
+        for(uint8_t c=0; c<COLS; ++c)
+            if(getStenoKey(r, c) == key) {
+                *row = r;
+                *col = c;
+                return true;
+            }
+    return false;
+}
+
+/**
+ * Steno chords pressed and released rolled over through the whole firmware must
+ * each give exactly one GeminiPR packet, as laid out in the protocol:
+ *
+ *     1 Fn #1 #2 #3 #4 #5 #6 | 0 S1 S2 T  K  P  W  H  | 0 R  A  O  *1 *2 re re
+ *     0 pw *3 *4 E  U  -F -R | 0 -P -B -L -G -T -S -D | 0 #7 #8 #9 #A #B #C -Z
+ *
+ * Chords with keys missing on the board are skipped. Keys without a steno meaning
+ * are still typed.
+ */
+static bool check_steno(void)
+{
+    static const struct {
+        uint8_t keys[8];
+        uint8_t packet[STENO_PACKET_SIZE];
+    } chords[] = {
+        { { ST_S1 },                                    { 0x80, 0x40, 0x00, 0x00, 0x00, 0x00 } },
+        { { ST_TL, ST_A, ST_E, ST_FR },                 { 0x80, 0x10, 0x20, 0x0A, 0x00, 0x00 } },
+        { { ST_N3, ST_ST1, ST_ZR },                     { 0x88, 0x00, 0x08, 0x00, 0x00, 0x01 } },
+        { { ST_PR, ST_BR, ST_LR, ST_GR, ST_TR, ST_SR, ST_DR }, { 0x80, 0x00, 0x00, 0x00, 0x7F, 0x00 } },
+        { { ST_S2, ST_KL, ST_WL, ST_HL, ST_RL, ST_O, ST_U, ST_ST2 }, { 0x80, 0x2B, 0x54, 0x04, 0x00, 0x00 } },
+    };
+    bool ok = true;
+    uint8_t sent = 0;
+
+    press_all(false);
+    ticks(1000);
+    steno_enable(true);
+    for(uint8_t c=0; c<sizeof(chords)/sizeof(chords[0]); ++c) {
+        uint8_t row[8], col[8], n = 0;
+        uint32_t packets = host_steno_packets;
+
+        for(; n<8 && chords[c].keys[n]; ++n)
+            if(!find_steno_key(chords[c].keys[n], &row[n], &col[n]))
+                break;
+        if(n<8 && chords[c].keys[n])
+            continue;
+        ++sent;
+        // rolled: each key is released after the next one was pressed
+        for(uint8_t i=0; i<n; ++i) {
+            key(row[i], col[i], true);
+            ticks(15);
+            if(i)
+                key(row[i-1], col[i-1], false);
+            ticks(15);
+            if(host_steno_packets != packets) {
+                printf("  chord %u sent before all keys were released\n", c);
+                ok = false;
+            }
+        }
+        key(row[n-1], col[n-1], false);
+        ticks(100);
+
+        if(host_steno_packets != packets + 1 || memcmp(host_steno_packet, chords[c].packet, STENO_PACKET_SIZE)) {
+            printf("  chord %u: %u packets, last", c, host_steno_packets - packets);
+            for(uint8_t i=0; i<STENO_PACKET_SIZE; ++i)
+                printf(" %02X", host_steno_packet[i]);
+            printf("\n");
+            ok = false;
+        }
+    }
+
+    // regular keys keep their meaning
+    uint8_t r, c;
+    for(r=0; r<ROWS; ++r) {
+        for(c=0; c<COLS && (getStenoKey(r, c) || getKeyStruct(r, c, 0).hid < HID_A
+                            || getKeyStruct(r, c, 0).hid > HID_Z); ++c)
+            ;
+        if(c < COLS)
+            break;
+    }
+    if(r < ROWS) {
+        uint32_t packets = host_steno_packets;
+        key(r, c, true);
+        ticks(100);
+        if(!report_has(getKeyStruct(r, c, 0).hid) || host_steno_packets != packets) {
+            printf("  regular key not typed in steno mode\n");
+            ok = false;
+        }
+        key(r, c, false);
+        ticks(100);
+    }
+    steno_enable(false);
+    printf("  %u chords\n", sent);
+    return ok && sent;
+}
+#endif
+
+/**
+ * Tap and hold decisions for random sequences of a dual use key held on other key
+ * presses and two normal keys, compared against the model in tools/dualuse.c.
+ */
+static bool check_dualuse(void)
+{
+    enum { RUNS = 500, KEYS = 4 };
+    uint8_t du_row=ROWS, du_col=0, plain[2][2];
+
+    for(uint8_t r=0; r<ROWS; ++r)
+        for(uint8_t c=0; c<COLS; ++c) {
+            keycode k = getKeyStruct(r, c, 0);
+            if(k.hid == HID_TAB && k.mods == (TAPPING_MASK|MOD_L_CTRL)) {
+                du_row = r;
+                du_col = c;
+            }
+        }
+    if(du_row == ROWS || plain_keys(plain, 2) < 2) {
+        printf("  no tab/ctrl dual use key in layer 0\n");
+        return true;
+    }
+    dualuse_t du = getDualUse(du_row, du_col);
+    if(du.policy != DUAL_HOLD_ON_OTHER_KEY) {
+        printf("  model only covers hold on other key\n");
+        return true;
+    }
+    uint8_t term = du.term/DUAL_TICK, repeat = TAP_TIMEOUT_REPEAT/DUAL_TICK;
+    unsigned failed = 0, decisions[3] = { 0 };
+
+    press_all(false);
+    ticks(1000);
+    srand(1);
+    for(unsigned run=0; run<RUNS; ++run) {
+        dual_key_t keys[KEYS];
+        bool used[256] = { false };
+        uint8_t n = 0, last = 0, t = 1 + rand()%10;
+
+        // dual use key pressed one to two times, around its term and repeat timeout
+        for(uint8_t i=0, presses=1+rand()%2; i<presses; ++i, ++n) {
+            keys[n] = (dual_key_t) { du_row, du_col, dual_free_tick(used, t), 0, true };
+            keys[n].release = dual_free_tick(used, keys[n].press + 1 + rand()%(term+10));
+            t = keys[n].release + 1 + rand()%(2*repeat);
+        }
+        for(uint8_t i=0, normal=rand()%3; i<normal; ++i, ++n) {
+            keys[n] = (dual_key_t) { plain[i][0], plain[i][1], dual_free_tick(used, 1 + rand()%120), 0, false };
+            keys[n].release = dual_free_tick(used, keys[n].press + 1 + rand()%40);
+        }
+
+        char spec[KEYS][12], *args[KEYS], model[KEYS], fw[KEYS];
+        for(uint8_t i=0; i<n; ++i) {
+            snprintf(spec[i], sizeof(spec[i]), "%u%c%c%u", keys[i].press, keys[i].dual ? 'D' : 'n',
+                     keys[i].dual ? 'D' : 'a'+i, keys[i].release);
+            args[i] = spec[i];
+            if(keys[i].release > last)
+                last = keys[i].release;
+        }
+        uint8_t end = last + term + 10;
+
+        dualuse_run(n, args, term, repeat, end, model);
+        dual_firmware(keys, n, end, HID_TAB, fw);
+        ticks(1000);
+
+        for(uint8_t i=0; i<n; ++i) {
+            if(keys[i].dual)
+                decisions[fw[i]=='d' ? 0 : fw[i]=='m' ? 1 : 2]++;
+            if(fw[i] != model[i]) {
+                if(failed++ < 5) {
+                    printf("  ");
+                    for(uint8_t k=0; k<n; ++k)
+                        printf("%s ", spec[k]);
+                    printf(": key %u model %c firmware %c\n", i, model[i], fw[i]);
+                }
+                break;
+            }
+        }
+    }
+    printf("  %u sequences: %u taps, %u holds, %u repeats, %u differ\n",
+           RUNS, decisions[0], decisions[1], decisions[2], failed);
+    return !failed;
+}
+
+#ifdef NKRO
+extern USB_ClassInfo_HID_Device_t Keyboard_HID_Interface;
+
+/// Input field of a HID report descriptor.
+typedef struct {
+    uint16_t page, usage_min, usage_max;
+    uint16_t bit;           ///< offset in report
+    uint8_t  size, count;   ///< bits per value, values
+    bool     variable;      ///< one bit per usage instead of an array of usages
+} hid_field_t;
+
+/// Decode the input fields of a report descriptor, returns their number.
+static uint8_t hid_decode(const uint8_t *desc, uint8_t len, hid_field_t *field, uint8_t max)
+{
+    uint16_t page=0, usage_min=0, usage_max=0, bit=0;
+    uint8_t  size=0, count=0, n=0;
+
+    for(uint8_t i=0; i<len; ) {
+        uint8_t  item  = desc[i] & 0xFC;
+        uint8_t  bytes = (desc[i] & 3) == 3 ? 4 : desc[i] & 3;
+        uint32_t data  = 0;
+
+        for(uint8_t b=0; b<bytes; ++b)
+            data |= (uint32_t)desc[i+1+b] << 8*b;
+        i += 1 + bytes;
+
+        switch(item) {
+            case 0x04: page = data; break;
+            case 0x74: size = data; break;
+            case 0x94: count = data; break;
+            case 0x18: usage_min = data; break;
+            case 0x28: usage_max = data; break;
+            case 0x80:
+                if(n < max)
+                    field[n++] = (hid_field_t) { page, usage_min, usage_max, bit, size, count, data & HID_IOF_VARIABLE };
+                bit += size*count;
+                usage_min = usage_max = 0;  // local items
+                break;
+        }
+    }
+    return n;
+}
+
+/**
+ * NKRO interface: the report descriptor must describe USB_NKROReport_Data_t as
+ * modifier bits and a key bitmap, and the report decoded along the descriptor
+ * must hold exactly the pressed keys, beyond the 6 of the boot report.
+ */
+static bool check_nkro(void)
+{
+    static const uint8_t desc[] = { HID_DESCRIPTOR_NKRO(NKRO_KEYS_BYTES) };
+    hid_field_t f[4];
+    uint8_t n = hid_decode(desc, sizeof(desc), f, 4);
+    bool ok = true;
+
+    if( n != 2 || f[1].bit + f[1].size*f[1].count != 8*sizeof(USB_NKROReport_Data_t)
+        || f[0].page != 0x07 || f[0].usage_min != 0xE0 || f[0].usage_max != 0xE7
+        || f[0].bit != 0 || f[0].size != 1 || f[0].count != 8 || !f[0].variable
+        || f[1].page != 0x07 || f[1].usage_min != 0 || f[1].usage_max != NKRO_KEYS_BYTES*8-1
+        || f[1].bit != 8 || f[1].size != 1 || f[1].count != NKRO_KEYS_BYTES*8 || !f[1].variable ) {
+        printf("  descriptor does not match the report\n");
+        return false;
+    }
+
+    enum { HELD = 10 };
+    uint8_t keys[HELD][2];
+    bool expected[256] = { false }, decoded[256] = { false };
+    uint8_t held = plain_keys(keys, HELD);
+
+    for(uint8_t i=0; i<held; ++i)
+        expected[getKeyStruct(keys[i][0], keys[i][1], 0).hid] = true;
+
+    // one plain modifier, the right GUI one is used as Int1 key
+    uint8_t mod_row=ROWS, mod_col=0;
+    for(uint8_t r=0; r<ROWS && mod_row==ROWS; ++r)
+        for(uint8_t c=0; c<COLS && mod_row==ROWS; ++c) {
+            uint8_t mod = getModifier(r, c, 0);
+            if(mod >= MOD_FIRST && mod < MOD_R_GUI) {
+                mod_row = r;
+                mod_col = c;
+                expected[0xE0 + mod - MOD_FIRST] = true;
+            }
+        }
+
+    bool nkro = g_cfg.fw.nkro, protocol = Keyboard_HID_Interface.State.UsingReportProtocol;
+    g_cfg.fw.nkro = true;
+    Keyboard_HID_Interface.State.UsingReportProtocol = true;
+
+    press_all(false);
+    ticks(1000);
+    for(uint8_t i=0; i<held; ++i) {
+        key(keys[i][0], keys[i][1], true);
+        ticks(50);
+    }
+    if(mod_row < ROWS)
+        key(mod_row, mod_col, true);
+    ticks(500);
+
+    USB_KeyboardReport_Data_t boot;
+    USB_NKROReport_Data_t report;
+    markReportDirty();
+    getKeyboardReport(&boot);
+    getNKROReport(&report);
+
+    const uint8_t *bytes = (const uint8_t *)&report;
+    for(uint8_t i=0; i<n; ++i)
+        for(uint8_t v=0; v<f[i].count; ++v) {
+            uint16_t bit = f[i].bit + v;
+            if(bytes[bit>>3] & (1<<(bit&7)))
+                decoded[f[i].usage_min + v] = true;
+        }
+    for(uint16_t u=0; u<256; ++u)
+        if(expected[u] != decoded[u]) {
+            printf("  usage %02X %s\n", u, expected[u] ? "missing" : "not pressed");
+            ok = false;
+        }
+    for(uint8_t i=0; i<6; ++i)
+        if(boot.KeyCode[i]) {
+            printf("  boot report not empty while NKRO is active\n");
+            ok = false;
+            break;
+        }
+
+    press_all(false);
+    ticks(1000);
+    markReportDirty();
+    getKeyboardReport(&boot);
+    getNKROReport(&report);
+    for(uint8_t i=0; i<sizeof(report); ++i)
+        if(bytes[i]) {
+            printf("  NKRO report not empty after release\n");
+            ok = false;
+            break;
+        }
+
+    g_cfg.fw.nkro = nkro;
+    Keyboard_HID_Interface.State.UsingReportProtocol = protocol;
+    return ok && held == HELD && mod_row < ROWS;
+}
+#endif
+
+#ifdef MATRIX_SCAN_IN_ISR
+/**
+ * Configuration sanity of the settle waits: every row of the simulated matrix is read
+ * no earlier than MATRIX_SETTLE_US after it was activated, and the scan timer wait adds
+ * at most two counts to that. Debouncing takes no simulated time, so this shows nothing
+ * about what pipelining saves, make scan-cycles counts that on simavr.
+ */
+static bool check_scan_timing(void)
+{
+    const double count_us = 8e6/F_CPU;
+
+    host_settle_min_us = 1e9;
+    double begin = host_busy_us;
+    scan_once();
+    double waited = host_busy_us - begin;
+
+    printf("  %u rows: %.1f us busy wait per scan, rows settled at least %.1f us of %u us\n",
+           ROWS, waited, host_settle_min_us, MATRIX_SETTLE_US);
+    return host_settle_min_us >= MATRIX_SETTLE_US
+        && waited <= ROWS * (MATRIX_SETTLE_US + 2*count_us);
+}
+#endif
+
+#ifdef HAS_I2C
+// register by register access of src/mcp23018.h, replaced by burst scanning
+void    mcp23018_all_cols_highz(void);
+void    mcp23018_col_low(uint8_t n);
+uint8_t mcp23018_read_rows(void);
+
+/// Run the bus until all queued transfers are done.
+static void i2c_finish(void)
+{
+    while(!host_i2c_idle()) {
+        TIMER0_COMPA_vect();
+        host_i2c_run(1000);
+    }
+}
+
+/**
+ * BLACKBOWL expanders: a burst scan takes two transfers per row, one selecting the
+ * column and one reading the rows, and one more per change of halves releasing the
+ * columns of the other one. Compared against the register by register access.
+ */
+static bool check_i2c_scan(void)
+{
+    event_model_t m = { .ok = true };
+    const uint16_t scans = 100;
+
+    press_all(false);
+    event_settle(&m);
+    host_matrix[5] = 1<<2;  // a key down keeps full scans running
+    event_settle(&m);
+
+    host_i2c_t begin = host_i2c;
+    for(uint16_t i=0; i<scans; ++i)
+        scan_once();
+    uint32_t transfers = host_i2c.transfers - begin.transfers;
+    uint32_t bytes     = host_i2c.bytes     - begin.bytes;
+    double   bus_us    = host_i2c.bus_us    - begin.bus_us;
+
+    i2c_finish();
+    begin = host_i2c;
+    mcp23018_all_cols_highz();
+    mcp23018_col_low(0);
+    mcp23018_read_rows();
+    uint32_t row_transfers = host_i2c.transfers - begin.transfers;
+    uint32_t row_bytes     = host_i2c.bytes     - begin.bytes;
+
+    printf("  burst: %.1f transfers, %.1f bytes, %.0f us bus time per scan\n",
+           (double)transfers/scans, (double)bytes/scans, bus_us/scans);
+    printf("  register by register: %u transfers, %u bytes per row, %u transfers per scan\n",
+           row_transfers, row_bytes, ROWS*row_transfers);
+
+    // keys are still read right after the register access in between
+    host_matrix[5] = 0;
+    host_matrix[1] = 1<<4;
+    event_settle(&m);
+    bool ok = event_compare(&m);
+    press_all(false);
+    event_settle(&m);
+
+    if(transfers != scans*(2*ROWS+2) || bytes != scans*(7*ROWS+6)) {
+        printf("  expected %u transfers and %u bytes per scan\n", 2*ROWS+2, 7*ROWS+6);
+        return false;
+    }
+    return ok && event_compare(&m);
+}
+
+/// Run the bus and the main loop timeout check until x completed, at most for ms.
+static void i2c_wait(twi_xfer_t *x, uint16_t ms)
+{
+    for(uint16_t i=0; i<ms && x->status == TWI_PENDING; ++i) {
+        TIMER0_COMPA_vect();
+        host_i2c_run(1000);
+        twi_poll();
+    }
+}
+
+/**
+ * TWI errors: a missing slave is reported as TWI_NACK, a hung bus as TWI_TIMEOUT after
+ * recovery without busy-waiting in atomic blocks, and scanning goes on either way.
+ */
+static bool check_i2c_errors(void)
+{
+    event_model_t m = { .ok = true };
+    bool ok = true;
+
+    press_all(false);
+    event_settle(&m);
+    i2c_finish();
+
+    twi_errors_t before = twi_errors;
+    uint8_t buf;
+    twi_xfer_t x = { .addr = 0x40, .reg = 0x13, .rlen = 1, .data = &buf };
+
+    twi_submit(&x);
+    i2c_wait(&x, 100);
+    if(x.status != TWI_NACK || twi_errors.nack != before.nack+1) {
+        printf("  missing slave: status %u, %u NACKs\n", x.status, twi_errors.nack - before.nack);
+        ok = false;
+    }
+
+    double   atomic_us = host_atomic_busy_us, busy_us = host_busy_us;
+    uint16_t start     = timer_read();
+    host_i2c.stuck = true;
+    x.addr = 0x46;
+    twi_submit(&x);
+    i2c_wait(&x, 100);
+    if(x.status != TWI_TIMEOUT || twi_errors.timeout != before.timeout+1 || twi_errors.recovered != before.recovered+1) {
+        printf("  hung bus: status %u, %u timeouts, %u recoveries\n", x.status,
+               twi_errors.timeout - before.timeout, twi_errors.recovered - before.recovered);
+        ok = false;
+    }
+    if(host_i2c.stuck) {
+        printf("  bus not recovered\n");
+        ok = false;
+    }
+    if(host_atomic_busy_us != atomic_us) {
+        printf("  %.0f us busy wait with interrupts disabled\n", host_atomic_busy_us - atomic_us);
+        ok = false;
+    }
+    printf("  timeout after %u ms, %.0f us busy wait for recovery\n", timer_elapsed(start), host_busy_us - busy_us);
+
+    // keys of a missing half read as released, the other half is still scanned
+    host_i2c.absent[1] = true;
+    host_matrix[1] = 1<<3;
+    host_matrix[6] = 1<<1;
+    event_settle(&m);
+    host_matrix[6] = 0;
+    ok &= event_compare(&m);
+    host_i2c.absent[1] = false;
+    host_matrix[6] = 1<<1;
+    event_settle(&m);
+    ok &= event_compare(&m);
+    press_all(false);
+    event_settle(&m);
+
+    return ok && event_compare(&m);
+}
+#endif
+
+
+typedef struct {
+    const char *name;
+    bool (*run)(void);
+} check_t;
+
+static const check_t checks[] = {
+    { "event queue", check_event_queue },
+    { "debounce",    check_bounce },
+    { "all keys",    check_all_keys },
+    { "clock",       check_clock },
+    { "lookup",      check_lookup },
+    { "rebuilds",    check_rebuilds },
+    { "macro overlap", check_macro_overlap },
+    { "implicit mods", check_implicit_rolls },
+    { "combos",      check_combos },
+    { "layers",      check_layers },
+#ifdef STENO
+    { "steno",       check_steno },
+#endif
+    { "dual use",    check_dualuse },
+#ifdef NKRO
+    { "nkro",        check_nkro },
+#endif
+#ifdef MATRIX_SCAN_IN_ISR
+    { "scan timing", check_scan_timing },
+#endif
+#ifdef HAS_I2C
+    { "i2c scan",    check_i2c_scan },
+    { "i2c errors",  check_i2c_errors },
+#endif
+};
+
+/// Run all checks, returns 1 if any failed.
+int host_check(void)
+{
+    int ret = 0;
+
+    g_quiet = true;
+    for(uint8_t i=0; i<sizeof(checks)/sizeof(checks[0]); ++i) {
+        bool ok = checks[i].run();
+        printf("%s: %s\n", checks[i].name, ok ? "ok" : "FAILED");
+        if(!ok)
+            ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,10 @@
+/*
+ * Host build: ComboKeys[] of src/keymap.h is a table in RAM, defined in tools/host/host.c.
+ * Its entries stay empty and match no key, except while the combos check of
+ * tools/host/check.c has set them up.
+ */
+#pragma once
+
+#define HOST_COMBOS 3
+
+extern combo_t ComboKeys[HOST_COMBOS];
@@ -0,0 +1,951 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <setjmp.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <LUFA/Drivers/USB/USB.h>
+
+#include "src/keyboard_class.h"
+#include "src/matrix.h"
+#include "src/timer.h"
+#include "src/global_config.h"
+#include "src/keymap.h"
+#include "src/macro.h"
+#include "src/macro_heap.h"
+#include "src/ascii2hid.h"
+#include "tools/host/host.h"
+
+#undef printf // blocked for firmware code by print.h
+
+
+/* DOCUMENTATION
+
+Host build of the firmware core: keyboard_class, keymap, matrix debouncing,
+macro and command handling compiled natively against the mock headers in
+tools/host/mock, built with "make host" into .build/adnw_host.
+
+The replay driver simulates the clock: every millisecond it raises the Timer0
+tick, every 1000/MATRIX_SCAN_HZ ms the matrix scan timer, and then polls
+getKeyboardReport() like the USB stack does on the real board.
+
+Input  : key changes on stdin, e.g. from tools/tracedecode -r:
+
+             <time [ms]> +<key id>
+             <time [ms]> -<key id>
+
+         Key ids are row<<4|col in hex. Empty lines and lines starting with #
+         are ignored.
+Output : every changed keyboard report, as time [ms] since the first input line,
+         modifier and keys in hex.
+
+Options: -n      enable NKRO and use report protocol, keys are taken from the NKRO bitmap
+         -s      enable steno mode (KB_STENO builds), GeminiPR packets are printed
+                 in hex followed by the decoded steno keys
+         -b <n>  benchmark: replay input n times without output and print
+                 key event throughput of the whole pipeline.
+         -a      macro playback check: types all printable ASCII with setOutputString(),
+                 decodes the reports back to text with hid2asciicode() and compares.
+                 Then plays a recorded macro with a pause and checks its duration.
+                 Exits with 1 on a mismatch. No input is read.
+         -k <n>  benchmark getKeyStruct(): look up every key of every layer n times,
+                 e.g. to compare builds with KB_PACKED=0 and 1. No input is read.
+         -e <n>  macro heap check: n random macro updates and deletes checked against
+                 their expected content and the index against a restart, then n/8 more with a power loss at each single
+                 EEPROM write in turn and a restart. Exits with 1 on a mismatch.
+         -t      self checks of matrix and report logic, see tools/host/check.c.
+                 Exits with 1 if any fails. No input is read.
+
+Example: hid_listen | tools/tracedecode -r > keys.txt ; .build/adnw_host < keys.txt
+*/
+
+
+/*
+ * Registers, set up by the firmware init code but without effect here.
+ */
+#define SFR8(n) volatile uint8_t n;
+SFR8(PINB) SFR8(PINC) SFR8(PIND) SFR8(PINE) SFR8(PINF)
+SFR8(DDRB) SFR8(DDRC) SFR8(DDRD) SFR8(DDRE) SFR8(DDRF)
+SFR8(PORTB) SFR8(PORTC) SFR8(PORTD) SFR8(PORTE) SFR8(PORTF)
+SFR8(TCCR0A) SFR8(TCCR0B) SFR8(TIMSK0) SFR8(OCR0A)
+SFR8(TCCR1A) SFR8(TCCR1B) SFR8(TCCR3A) SFR8(TCCR3B) SFR8(TIMSK3)
+SFR8(TCCR4A) SFR8(TCCR4B) SFR8(TCCR4C) SFR8(OCR4D)
+SFR8(MCUSR) SFR8(SREG)
+volatile uint16_t OCR1A, OCR1B, OCR1C, ICR1, OCR3A;
+
+column_size_t host_matrix[ROWS];
+double        host_settle_min_us = 1e9;
+
+volatile uint8_t USB_DeviceState = DEVICE_STATE_Configured;
+USB_ClassInfo_HID_Device_t Keyboard_HID_Interface;
+
+void jump_bootloader(void)
+{
+    fprintf(stderr, "jump_bootloader() called\n");
+    exit(1);
+}
+
+
+/*
+ * EEPROM: a RAM image in erased state, so the firmware falls back to its defaults.
+ * Writes of changed bytes are counted per address. After host_ee_writes more writes
+ * the next one is lost to a power loss, which returns to the setjmp() on host_ee_powerloss.
+ */
+static uint8_t  host_eeprom[E2END+1];
+static uint32_t host_ee_wear[E2END+1];
+static long     host_ee_writes = -1;    ///< writes until power loss, -1 for none
+static jmp_buf  host_ee_powerloss;
+
+#define EE(p) (&host_eeprom[(uintptr_t)(p) & E2END])
+
+static void ee_write(const void *p, uint8_t value)
+{
+    if(*EE(p) == value)
+        return;
+    if(host_ee_writes == 0)
+        longjmp(host_ee_powerloss, 1);
+    if(host_ee_writes > 0)
+        --host_ee_writes;
+    *EE(p) = value;
+    ++host_ee_wear[(uintptr_t)(p) & E2END];
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    return *EE(p);
+}
+
+uint16_t eeprom_read_word(const uint16_t *p)
+{
+    return EE(p)[0] | EE(p)[1]<<8;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, EE(src), n);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+    ee_write(p, value);
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+    ee_write(p, value);
+}
+
+void eeprom_update_word(uint16_t *p, uint16_t value)
+{
+    ee_write(p, value & 0xFF);
+    ee_write((uint8_t *)p+1, value >> 8);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    for(size_t i=0; i<n; ++i)
+        ee_write((uint8_t *)dst+i, ((const uint8_t *)src)[i]);
+}
+
+
+/*
+ * Simulated clock. Busy waits advance the millisecond timer only, the matrix
+ * scan and report polling are driven by host_tick() from the replay loop.
+ */
+uint32_t        host_ms;    ///< simulated time since start
+double          host_busy_us;
+double          host_atomic_busy_us;
+uint32_t        host_flash_reads;
+uint32_t        host_report_builds;
+combo_t         ComboKeys[HOST_COMBOS];
+static uint8_t  host_atomic;    ///< ATOMIC_BLOCK nesting
+static double   host_us;    ///< busy wait time not yet accounted
+
+/// Flash contents replaced for memcpy_P(), see host_flash_patch()
+static struct {
+    const uint8_t *addr;
+    uint8_t        data[8];
+    size_t         n;
+} flash_patch[16];
+static uint8_t     flash_patches;
+const void        *host_flash_last;
+
+void *host_memcpy_P(void *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+
+    ++host_flash_reads;
+    host_flash_last = src;
+    memcpy(dst, src, n);
+    for(uint8_t i=0; i<flash_patches; ++i)
+        if(flash_patch[i].addr >= s && flash_patch[i].addr + flash_patch[i].n <= s + n)
+            memcpy((uint8_t *)dst + (flash_patch[i].addr - s), flash_patch[i].data, flash_patch[i].n);
+    return dst;
+}
+
+/// Read data[n] instead of the flash contents at addr, until host_flash_unpatch().
+void host_flash_patch(const void *addr, const void *data, size_t n)
+{
+    if(flash_patches == sizeof(flash_patch)/sizeof(flash_patch[0]) || n > sizeof(flash_patch[0].data))
+        abort();
+    flash_patch[flash_patches].addr = addr;
+    flash_patch[flash_patches].n    = n;
+    memcpy(flash_patch[flash_patches++].data, data, n);
+}
+
+void host_flash_unpatch(void)
+{
+    flash_patches = 0;
+}
+
+void host_atomic_enter(void)
+{
+    ++host_atomic;
+}
+
+void host_atomic_leave(void)
+{
+    --host_atomic;
+}
+
+void _delay_us(double us)
+{
+    host_busy_us += us;
+    if(host_atomic)
+        host_atomic_busy_us += us;
+    host_us += us;
+    while(host_us >= 1000) {
+        host_us -= 1000;
+        ++host_ms;
+        TIMER0_COMPA_vect();
+    }
+}
+
+void _delay_ms(double ms)
+{
+    _delay_us(ms*1000);
+}
+
+/// Simulated time [us], including busy waits not yet accounted as a millisecond tick.
+double host_now_us(void)
+{
+    return host_ms*1000.0 + host_us;
+}
+
+uint16_t host_tcnt3(void)
+{
+    const uint32_t period = F_CPU/8/MATRIX_SCAN_HZ;     // compare matches every scan period
+    _delay_us(8e6/F_CPU);
+    return (uint64_t)(host_now_us() * (F_CPU/8/1e6)) % period;
+}
+
+
+bool            g_quiet;    ///< no report output
+bool            g_nkro;     ///< reports from the NKRO bitmap
+static uint32_t g_start;    ///< host_ms at start of replay
+static uint32_t g_reports;  ///< changed reports
+host_report_t   host_report;
+uint8_t         host_steno_packet[STENO_PACKET_SIZE];
+uint32_t        host_steno_packets;
+
+static void print_report(uint8_t mod, const uint8_t *keys, uint8_t count)
+{
+    if(mod == host_report.mod && count == host_report.count && memcmp(keys, host_report.keys, count) == 0)
+        return;
+    host_report.mod   = mod;
+    host_report.count = count;
+    memcpy(host_report.keys, keys, count);
+    ++g_reports;
+    if(g_quiet)
+        return;
+
+    printf("%8u  %02X ", host_ms - g_start, mod);
+    for(uint8_t i=0; i<count; ++i)
+        printf(" %02X", keys[i]);
+    printf("\n");
+}
+
+#ifdef STENO
+/// Steno key names in GeminiPR bit order, see enum steno_key.
+static const char *steno_names[] = {
+    "Fn",  "#1",  "#2",  "#3",  "#4",  "#5",  "#6",
+    "S1-", "S2-", "T-",  "K-",  "P-",  "W-",  "H-",
+    "R-",  "A-",  "O-",  "*1",  "*2",  "res1","res2",
+    "pwr", "*3",  "*4",  "-E",  "-U",  "-F",  "-R",
+    "-P",  "-B",  "-L",  "-G",  "-T",  "-S",  "-D",
+    "#7",  "#8",  "#9",  "#A",  "#B",  "#C",  "-Z",
+};
+
+/// Print and decode all GeminiPR packets the steno interface would send now.
+static void host_steno(void)
+{
+    uint8_t packet[STENO_PACKET_SIZE];
+
+    while(steno_get_report(packet)) {
+        memcpy(host_steno_packet, packet, sizeof(packet));
+        ++host_steno_packets;
+        ++g_reports;
+        if(g_quiet)
+            continue;
+
+        printf("%8u  STENO", host_ms - g_start);
+        for(uint8_t i=0; i<STENO_PACKET_SIZE; ++i)
+            printf(" %02X", packet[i]);
+        printf(" ");
+        for(uint8_t k=0; k<STENO_PACKET_SIZE*7; ++k)
+            if(packet[k/7] & (0x40 >> (k%7)))
+                printf(" %s", steno_names[k]);
+        printf("\n");
+    }
+}
+#endif
+
+/// One millisecond of firmware time: timer ticks, then the host polls for a report.
+void host_tick(void)
+{
+    ++host_ms;
+    TIMER0_COMPA_vect();
+#ifdef MATRIX_SCAN_IN_ISR
+    if(host_ms % (1000/MATRIX_SCAN_HZ) == 0)
+        TIMER3_COMPA_vect();
+#endif
+    timer_task();
+
+    USB_KeyboardReport_Data_t report;
+    memset(&report, 0, sizeof(report));
+    uint8_t ret = getKeyboardReport(&report);
+#ifdef STENO
+    host_steno();
+#endif
+    host_i2c_run(1000); // scan transfers queued by the main loop
+    if(ret == 0)
+        return; // mouse report
+
+#ifdef NKRO
+    if(g_nkro) {
+        USB_NKROReport_Data_t nkro;
+        uint8_t keys[255], count=0;
+
+        getNKROReport(&nkro);
+        for(uint16_t hid=0; hid<8*NKRO_KEYS_BYTES && count<sizeof(keys); ++hid)
+            if(nkro.Keys[hid>>3] & (1<<(hid&7)))
+                keys[count++] = hid;
+        print_report(nkro.Modifier, keys, count);
+        return;
+    }
+#endif
+    print_report(report.Modifier, report.KeyCode, sizeof(report.KeyCode));
+}
+
+
+
+typedef struct {
+    uint32_t time;
+    uint8_t  id;
+    bool     press;
+} replay_t;
+
+static replay_t *g_events;
+static size_t    g_count;
+
+static void read_events(FILE *in)
+{
+    char line[128];
+    size_t size = 0;
+
+    while(fgets(line, sizeof(line), in)) {
+        unsigned time, id;
+        char change;
+
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        if(sscanf(line, "%u %c%x", &time, &change, &id) != 3 || (change != '+' && change != '-')
+                || (id>>4) >= ROWS || (id&0x0F) >= COLS) {
+            fprintf(stderr, "ignoring invalid line: %s", line);
+            continue;
+        }
+        if(g_count == size) {
+            size = size ? 2*size : 256;
+            g_events = realloc(g_events, size * sizeof(replay_t));
+        }
+        g_events[g_count++] = (replay_t) { time, id, change == '+' };
+    }
+}
+
+/// Feed all events into the matrix at their time offset from now, then let keys settle.
+static void replay(void)
+{
+    g_start = host_ms;
+
+    for(size_t i=0; i<g_count; ++i) {
+        while(host_ms - g_start < g_events[i].time)
+            host_tick();
+
+        column_size_t mask = (column_size_t)1 << (g_events[i].id & 0x0F);
+        if(g_events[i].press)
+            host_matrix[g_events[i].id >> 4] |=  mask;
+        else
+            host_matrix[g_events[i].id >> 4] &= ~mask;
+    }
+
+    memset(host_matrix, 0, sizeof(host_matrix));
+    for(uint16_t i=0; i<1000; ++i)
+        host_tick();
+}
+
+/// Time lookups of all keys in the given layers, the checksum keeps them from being optimized away.
+static void keymap_bench_layers(unsigned runs, uint8_t first, uint8_t last)
+{
+    uint32_t sum = 0;
+
+    clock_t begin = clock();
+    for(unsigned r=0; r<runs; ++r) {
+        for(uint8_t layer=first; layer<=last; ++layer)
+            for(uint8_t row=0; row<ROWS; ++row)
+                for(uint8_t col=0; col<COLS; ++col) {
+                    keycode kc = getKeyStruct(row, col, layer);
+                    sum += kc.hid + kc.mods;
+                }
+    }
+    double secs = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    double lookups = (double)runs * (last-first+1)*ROWS*COLS;
+
+    printf("  layers %u-%u: %.0f lookups in %.3f s, %.2f ns/lookup, checksum %08X\n",
+           first, last, lookups, secs, secs > 0 ? secs*1e9 / lookups : 0, sum);
+}
+
+static void keymap_bench(unsigned runs)
+{
+#ifdef KEYMAP_PACKED
+    printf("packed keymap:\n");
+#else
+    printf("dense keymap:\n");
+#endif
+    keymap_bench_layers(runs*(LAYERS-1), 0, 0);
+    keymap_bench_layers(runs, 1, LAYERS-1);
+}
+
+/// Decode each key that is new in report with the modifier of that report.
+static void decode_report(const USB_KeyboardReport_Data_t *report, uint8_t prev[6],
+                          char *typed, unsigned *count, unsigned max)
+{
+    for(uint8_t k=0; k<6; ++k) {
+        if(report->KeyCode[k] && !memchr(prev, report->KeyCode[k], 6) && *count < max)
+            typed[(*count)++] = hid2asciicode(report->KeyCode[k], report->Modifier);
+    }
+    memcpy(prev, report->KeyCode, 6);
+}
+
+/**
+ * Type all printable ASCII in chunks that fit the output buffer, and decode each key
+ * that is new in a report with the modifier of that report.
+ */
+static int playback_check(void)
+{
+    char text[96], typed[96], chunk[9];
+    uint8_t prev[6] = {0};
+    unsigned len=0, count=0, reports=0;
+
+    for(char ch=' '; ch<='~'; ++ch)
+        text[len++] = ch;
+
+    for(unsigned i=0; i<len; i+=8) {
+        memset(chunk, 0, sizeof(chunk));
+        memcpy(chunk, &text[i], len-i < 8 ? len-i : 8);
+        if(!setOutputString(chunk)) {
+            fprintf(stderr, "output buffer busy\n");
+            return 1;
+        }
+
+        USB_KeyboardReport_Data_t report;
+        memset(&report, 0, sizeof(report));
+        while(printOutstr(&report)) {
+            ++reports;
+            decode_report(&report, prev, typed, &count, sizeof(typed));
+            memset(&report, 0, sizeof(report));
+        }
+    }
+
+    bool ok = (count == len && memcmp(text, typed, len) == 0);
+    printf("%u characters typed in %u reports: %s\n", len, reports, ok ? "ok" : "MISMATCH");
+    if(!ok)
+        printf("expected %.*s\ntyped    %.*s\n", (int)len, text, (int)count, typed);
+    return ok ? 0 : 1;
+}
+
+/**
+ * Record a macro with a pause of two Alt+Return and play it back on the simulated
+ * clock, the pause must pass as empty reports until its timed event.
+ */
+static int pause_check(void)
+{
+    macro_heap_init();
+    setMacroRecording('p', 0, 0);
+    macro_key(HID_A, 0);
+    macro_key(HID_ENTER, HID_MOD_MASK(MOD_L_ALT));
+    macro_key(HID_ENTER, HID_MOD_MASK(MOD_L_ALT));
+    macro_key(HID_B, 0);
+    macro_key(HID_ENTER, HID_MOD_MASK(MOD_L_CTRL));
+    if(!printMacro('p')) {
+        fprintf(stderr, "macro not recorded\n");
+        return 1;
+    }
+
+    uint32_t start=host_ms, time_a=0, time_b=0;
+    unsigned empty=0;
+    USB_KeyboardReport_Data_t report;
+    do {
+        ++host_ms;
+        TIMER0_COMPA_vect();
+        timer_task();
+        memset(&report, 0, sizeof(report));
+        if(!printOutstr(&report))
+            break;
+        if(report.KeyCode[0] == HID_A && !time_a)
+            time_a = host_ms;
+        else if(report.KeyCode[0] == HID_B && !time_b)
+            time_b = host_ms;
+        else if(report.KeyCode[0] == 0 && time_a && !time_b)
+            ++empty;
+    } while(host_ms-start < 5000);
+
+    unsigned gap = time_b-time_a;
+    bool ok = time_a && time_b && gap >= 2*400 && gap < 2*400+10;
+    printf("pause of %u ms in %u empty reports: %s\n", gap, empty, ok ? "ok" : "MISMATCH");
+    return ok ? 0 : 1;
+}
+
+extern uint8_t g_pw[];
+
+/**
+ * Record a macro of more than 200 codes with an unlock code set, restart and play it
+ * back. It is streamed from eeprom and decrypted a few codes at a time.
+ */
+static int long_macro_check(void)
+{
+    char text[160], typed[160];
+    uint8_t prev[6] = {0};
+    unsigned len=0, count=0, codes=0;
+
+    for(uint8_t i=0; i<20; ++i)
+        g_pw[i] = 37*i+11;
+
+    // every third letter shifted, so it takes a modifier code
+    for(unsigned i=0; i<sizeof(text); ++i)
+        text[len++] = (i%3 ? 'a' : 'A') + (i*7)%26;
+
+    macro_heap_format();
+    setMacroRecording('L', 0, 0);
+    for(unsigned i=0; i<len; ++i) {
+        uint8_t hid, mod;
+        ascii2hid(text[i], &hid, &mod);
+        macro_key(hid, mod);
+        codes += mod ? 2 : 1;
+    }
+    macro_key(HID_ENTER, HID_MOD_MASK(MOD_L_CTRL));
+
+    macro_heap_init();
+    uint8_t stored=0;
+    macro_heap_find('L', &stored);
+    if(!printMacro('L')) {
+        fprintf(stderr, "macro not recorded\n");
+        return 1;
+    }
+
+    USB_KeyboardReport_Data_t report;
+    for(unsigned n=0; n<10000; ++n) {
+        ++host_ms;
+        TIMER0_COMPA_vect();
+        timer_task();
+        memset(&report, 0, sizeof(report));
+        if(!printOutstr(&report))
+            break;
+        decode_report(&report, prev, typed, &count, sizeof(typed));
+    }
+
+    bool ok = (stored == codes && count == len && memcmp(text, typed, len) == 0);
+    printf("macro of %u codes (%u stored) played back: %s\n", codes, stored, ok ? "ok" : "MISMATCH");
+    if(!ok)
+        printf("expected %.*s\ntyped    %.*s\n", (int)len, text, (int)count, typed);
+    memset(g_pw, 0, 20);
+    return ok ? 0 : 1;
+}
+
+/*
+ * Macro heap check, see -e. The expected content of each macro is kept in RAM.
+ */
+#define HEAP_MACROS 16
+
+static const char heap_sel[HEAP_MACROS+1] = "09azAZ1bYc2Xd3We";
+static uint8_t    heap_data[HEAP_MACROS][255];
+static int        heap_len[HEAP_MACROS];   ///< -1 if not stored
+
+/// Check all macros against the expected ones, macro i may also have data[len] or none.
+static bool heap_verify(int i, const uint8_t *data, int len)
+{
+    uint8_t it=0;
+    unsigned count=0;
+    while(macro_heap_next(&it) != 0)
+        ++count;
+    if(count > HEAP_MACROS) {
+        printf("%u macros\n", count);
+        return false;
+    }
+    for(int m=0; m<HEAP_MACROS; ++m) {
+        uint16_t rec;
+        uint8_t buf[255], n;
+        rec = macro_heap_find(heap_sel[m], &n);
+        if(rec != MACRO_HEAP_NONE)
+            macro_heap_read(rec, 0, buf, n);
+
+        bool ok = (rec == MACRO_HEAP_NONE) ? heap_len[m] < 0
+                                           : heap_len[m] == n && memcmp(buf, heap_data[m], n) == 0;
+        if(!ok && m == i)
+            ok = (rec == MACRO_HEAP_NONE) ? len < 0 : len == n && memcmp(buf, data, n) == 0;
+        if(!ok) {
+            printf("macro %c: %s\n", heap_sel[m], rec == MACRO_HEAP_NONE ? "missing" : "wrong content");
+            return false;
+        }
+    }
+    return true;
+}
+
+/// The index must match the one rebuilt from EEPROM on restart, which must need no repair.
+static bool heap_index_check(void)
+{
+    static uint8_t image[E2END+1];
+    uint16_t rec[256];
+    uint8_t  len[256];
+
+    for(int c=0; c<256; ++c)
+        rec[c] = macro_heap_find(c, &len[c]);
+    uint8_t avail = macro_heap_free();
+    memcpy(image, host_eeprom, sizeof(image));
+    macro_heap_init();
+
+    if(macro_heap_free() != avail) {
+        printf("free space %u, in EEPROM %u\n", avail, macro_heap_free());
+        return false;
+    }
+    for(int c=0; c<256; ++c) {
+        uint8_t n;
+        uint16_t r = macro_heap_find(c, &n);
+        if(r != rec[c] || (r != MACRO_HEAP_NONE && n != len[c])) {
+            printf("index of macro %c: %04X/%u, in EEPROM %04X/%u\n", c, rec[c], len[c], r, n);
+            return false;
+        }
+    }
+    if(memcmp(image, host_eeprom, sizeof(image)) != 0) {
+        printf("restart changed EEPROM\n");
+        return false;
+    }
+    return true;
+}
+
+/// Random update of macro i with data[len], or delete for len -1.
+static bool heap_op(int *i, uint8_t *data, int *len)
+{
+    *i = rand() % HEAP_MACROS;
+    *len = (rand() % 5 == 0) ? -1 : 1 + rand() % (rand() % 8 ? 40 : 200);
+    for(int k=0; k < *len; ++k)
+        data[k] = rand();
+
+    if(*len < 0) {
+        macro_heap_delete(heap_sel[*i]);
+        return true;
+    }
+    return macro_heap_write(heap_sel[*i], data, *len);
+}
+
+/// Set expected content of macro i after a successful update.
+static void heap_expect(int i, const uint8_t *data, int len)
+{
+    heap_len[i] = len;
+    if(len > 0)
+        memcpy(heap_data[i], data, len);
+}
+
+/**
+ * Macros of the former fixed slots: a map of 12 selectors at EE_ADDR_START, then
+ * slots of a length byte and 40 data bytes. Slot 3 is free and slot 7 repeats the
+ * selector of slot 1, which shadows it. The records take more space than is left
+ * after the slots, so the import wraps around into them.
+ */
+static void import_slots_write(void)
+{
+    memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+    memset(heap_len, -1, sizeof(heap_len));
+    for(int idx=0; idx<12; ++idx) {
+        int m = idx == 7 ? 1 : idx;
+        uint8_t *slot = &host_eeprom[EE_ADDR_START + 12 + idx*41];
+
+        host_eeprom[EE_ADDR_START + idx] = idx == 3 ? 0xFF : heap_sel[m];
+        slot[0] = idx % 2 == 0 ? 40 : 20 + rand() % 21;
+        for(int k=0; k<slot[0]; ++k)
+            slot[1+k] = rand();
+        if(idx != 3 && idx != 7)
+            heap_expect(m, &slot[1], slot[0]);
+    }
+}
+
+/**
+ * Start on the former fixed slots, all macros must be imported, then with a power
+ * loss at each single EEPROM write of the import, after a restart each macro must
+ * be imported or missing and an update must work.
+ */
+static bool import_check(void)
+{
+    static uint8_t image[E2END+1];
+    uint8_t test[3] = { 1, 2, 3 };
+
+    import_slots_write();
+    memcpy(image, host_eeprom, sizeof(image));
+    macro_heap_init();
+    if(!heap_verify(-1, NULL, 0) || !heap_index_check()) {
+        printf("import of the fixed macro slots\n");
+        return false;
+    }
+
+    unsigned losses=0;
+    for(volatile long k=0; ; ++k) {
+        memcpy(host_eeprom, image, sizeof(image));
+        volatile bool done=false;
+        host_ee_writes = k;
+        if(setjmp(host_ee_powerloss) == 0) {
+            macro_heap_init();
+            done = true;
+        }
+        host_ee_writes = -1;
+        if(done)
+            break;
+        ++losses;
+
+        macro_heap_init(); // restart
+        int expected[HEAP_MACROS];
+        memcpy(expected, heap_len, sizeof(expected));
+        for(int m=0; m<HEAP_MACROS; ++m) {
+            uint8_t n;
+            if(macro_heap_find(heap_sel[m], &n) == MACRO_HEAP_NONE)
+                heap_len[m] = -1;
+        }
+        bool ok = heap_verify(-1, NULL, 0);
+        memcpy(heap_len, expected, sizeof(expected));
+        if(!ok) {
+            printf("after power loss at write %ld of the import\n", k);
+            return false;
+        }
+        if(!macro_heap_write(heap_sel[HEAP_MACROS-1], test, sizeof(test))) {
+            printf("update after power loss at write %ld of the import failed\n", k);
+            return false;
+        }
+    }
+    printf("import of fixed macro slots, power loss at each of %u writes: ok\n", losses);
+    return true;
+}
+
+/**
+ * Import of the former fixed macro slots, see import_check().
+ * Random updates and deletes of macros, each checked against the expected content,
+ * where updates must fail exactly if longer than macro_heap_free() before, and the
+ * index against a restart.
+ * Then the same with a power loss at each single EEPROM write of an update in turn,
+ * after a restart all macros must have either their previous or new content and a
+ * following update must work.
+ */
+static int heap_check(unsigned ops)
+{
+    static uint8_t snapshot[E2END+1];
+    uint8_t data[255];
+    int i, len;
+    unsigned failed=0, bytes=0;
+
+    if(!import_check())
+        return 1;
+
+    memset(heap_len, -1, sizeof(heap_len));
+    memset(host_ee_wear, 0, sizeof(host_ee_wear));
+    macro_heap_format();
+
+    for(unsigned op=0; op<ops; ++op) {
+        uint8_t avail = macro_heap_free();
+        bool ok = heap_op(&i, data, &len);
+        if(len > 0 && (len <= avail) != ok) {
+            printf("update of %d bytes with %u free: %s\n", len, avail, ok ? "ok" : "failed");
+            return 1;
+        }
+        if(ok) {
+            heap_expect(i, data, len);
+            bytes += len > 0 ? len : 0;
+        } else {
+            ++failed;
+        }
+        if(!heap_index_check() || !heap_verify(-1, NULL, 0))
+            return 1;
+    }
+
+    uint32_t wear=0, writes=0;
+    for(unsigned a=EE_ADDR_MACRO_HEAP; a<EE_ADDR_TAG; ++a) {
+        writes += host_ee_wear[a];
+        if(host_ee_wear[a] > wear)
+            wear = host_ee_wear[a];
+    }
+    printf("%u updates of %u bytes, %u out of space: %u writes, at most %u per heap byte\n",
+           ops, bytes, failed, writes, wear);
+
+    unsigned losses=0;
+    for(unsigned op=0; op<ops/8; ++op) {
+        memcpy(snapshot, host_eeprom, sizeof(snapshot));
+        unsigned state = rand();
+
+        for(volatile long k=0; ; ++k) {
+            memcpy(host_eeprom, snapshot, sizeof(snapshot));
+            macro_heap_init();
+            srand(state);
+
+            volatile bool done=false, ok=false;
+            host_ee_writes = k;
+            if(setjmp(host_ee_powerloss) == 0) {
+                ok = heap_op(&i, data, &len);
+                done = true;
+            }
+            host_ee_writes = -1;
+            if(done && ok)
+                heap_expect(i, data, len);
+
+            macro_heap_init(); // restart
+            if(!heap_verify(done ? -1 : i, data, len)) {
+                printf("after power loss at write %ld of update %u\n", k, op);
+                return 1;
+            }
+            if(done)
+                break;
+            ++losses;
+
+            // another macro can still be updated, expected content restored for next k
+            int j = (i+1) % HEAP_MACROS, saved_len = heap_len[j];
+            uint8_t saved[255], test[3] = { 1, 2, 3 };
+            memcpy(saved, heap_data[j], sizeof(saved));
+
+            bool fits = sizeof(test) <= macro_heap_free();
+            bool ok2  = macro_heap_write(heap_sel[j], test, sizeof(test));
+            if(ok2)
+                heap_expect(j, test, sizeof(test));
+            ok2 = ok2 == fits && heap_verify(i, data, len);
+            heap_len[j] = saved_len;
+            memcpy(heap_data[j], saved, sizeof(saved));
+            if(!ok2) {
+                printf("update after power loss at write %ld of update %u failed\n", k, op);
+                return 1;
+            }
+        }
+    }
+    printf("power loss at each write of %u updates, %u restarts: ok\n", ops/8, losses);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned runs = 0, lookups = 0, heap_ops = 0;
+    bool steno = false, ascii = false, check = false;
+
+    memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+
+    for(int i=1; i<argc; ++i) {
+        if(strcmp(argv[i], "-n") == 0) {
+            g_nkro = true;
+        } else if(strcmp(argv[i], "-s") == 0) {
+            steno = true;
+        } else if(strcmp(argv[i], "-a") == 0) {
+            ascii = true;
+        } else if(strcmp(argv[i], "-t") == 0) {
+            check = true;
+        } else if(strcmp(argv[i], "-k") == 0 && i+1 < argc) {
+            lookups = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-e") == 0 && i+1 < argc) {
+            heap_ops = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-b") == 0 && i+1 < argc) {
+            runs = atoi(argv[++i]);
+            g_quiet = true;
+        } else {
+            fprintf(stderr, "usage: %s [-n] [-s] [-a] [-t] [-b runs] [-k runs] [-e ops] < keys.txt\n", argv[0]);
+            return 1;
+        }
+    }
+#ifndef NKRO
+    if(g_nkro) {
+        fprintf(stderr, "built without NKRO\n");
+        return 1;
+    }
+#endif
+#ifndef STENO
+    if(steno) {
+        fprintf(stderr, "built without STENO\n");
+        return 1;
+    }
+#endif
+    if(lookups) {
+        keymap_bench(lookups);
+        return 0;
+    }
+    if(heap_ops)
+        return heap_check(heap_ops);
+    if(ascii)
+        return playback_check() | pause_check() | long_macro_check();
+    if(check) {
+        SetupHardware();
+        return host_check();
+    }
+    Keyboard_HID_Interface.State.UsingReportProtocol = g_nkro;
+
+    read_events(stdin);
+
+    SetupHardware();
+    g_cfg.fw.nkro = g_nkro;
+#ifdef STENO
+    steno_enable(steno);
+#endif
+
+    if(!runs) {
+        replay();
+        return 0;
+    }
+
+    clock_t begin = clock();
+    uint32_t sim_start = host_ms;
+    for(unsigned r=0; r<runs; ++r)
+        replay();
+    double secs = (double)(clock() - begin) / CLOCKS_PER_SEC;
+
+    printf("%u runs, %zu key events, %u reports, %u ms simulated in %.3f s\n",
+           runs, runs*g_count, g_reports, host_ms - sim_start, secs);
+    if(secs > 0)
+        printf("%.0f key events/s, %.0f simulated ms/s\n",
+               runs*g_count / secs, (host_ms - sim_start) / secs);
+    return 0;
+}
+
+// make host && .build/adnw_host [-n] [-s] [-a] [-t] [-b runs] [-k runs] < keys.txt
@@ -0,0 +1,72 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "src/steno.h"
+
+/// Simulation interface of tools/host/host.c for the checks in tools/host/check.c
+
+/// Last changed keyboard report, keys in 6KRO slot order or from the NKRO bitmap.
+typedef struct {
+    uint8_t mod;
+    uint8_t count;
+    uint8_t keys[255];
+} host_report_t;
+
+extern uint32_t      host_ms;       ///< simulated time since start
+extern double        host_busy_us;  ///< total time spent in _delay_us()
+extern double        host_atomic_busy_us;   ///< ... of that inside ATOMIC_BLOCK
+extern uint32_t      host_flash_reads;  ///< pgm_read_*() and memcpy_P() calls
+extern host_report_t host_report;
+extern uint8_t       host_steno_packet[STENO_PACKET_SIZE];  ///< last GeminiPR packet sent
+extern uint32_t      host_steno_packets;
+extern bool          g_quiet;       ///< no report output
+extern bool          g_nkro;        ///< reports from the NKRO bitmap
+
+/// Simulated I2C bus with the expanders of BLACKBOWL, see tools/host/i2c.c
+typedef struct {
+    uint32_t transfers;     ///< stop conditions
+    uint32_t starts;        ///< start and repeated start conditions
+    uint32_t bytes;         ///< address and data bytes
+    uint32_t row_reads;     ///< reads of GPIOB
+    double   bus_us;        ///< time the bus was busy
+    bool     absent[2];     ///< expander at 0x46 or 0x4E does not respond
+    bool     stuck;         ///< a slave holds SDA low, the bus hangs until the TWI is reset
+} host_i2c_t;
+
+extern host_i2c_t    host_i2c;
+
+void TIMER0_COMPA_vect(void);
+void TIMER3_COMPA_vect(void);
+void TWI_vect(void);
+
+void host_i2c_run(double us);
+bool host_i2c_idle(void);
+
+void host_tick(void);
+
+/// Dual use key model of tools/dualuse.c, see there.
+void dualuse_run(int count, char **keys, uint8_t release_timeout, uint8_t repeat_timeout,
+                 uint8_t end, char *result);
+
+int  host_check(void);
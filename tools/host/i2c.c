@@ -0,0 +1,240 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <avr/io.h>
+#include <util/delay.h>
+#include <compat/twi.h>
+
+#include "src/config.h"
+#include "src/matrix.h"
+#include "tools/host/host.h"
+
+
+/* DOCUMENTATION
+
+Simulated TWI peripheral of the ATmega32U4 with the two MCP23018 expanders of
+BLACKBOWL at 0x46 (rows 0-3) and 0x4E (rows 4-7) attached.
+
+A command written to TWCR is carried out either on the next access to TWCR,
+which completes the busy waits of the blocking code in twimaster.c, or for
+interrupt driven commands (TWIE set) by host_i2c_run() as bus time passes,
+which then raises TWI_vect.
+
+A stuck slave holding SDA low (host_i2c.stuck) blocks all commands and reads
+as SDA low on PIND, until the TWI is disabled for bus recovery.
+
+Each expander selects a matrix row by driving one GPA pin low, and reads the
+columns on GPB as pulled up inputs, low where host_matrix has a key pressed.
+*/
+
+
+volatile uint8_t TWSR, TWDR, TWBR;
+static volatile uint8_t twcr;
+
+#define TWCR_DONE (1<<1) ///< reserved bit: command in twcr was carried out
+
+host_i2c_t host_i2c;
+
+// MCP23018 registers in IOCON.BANK=0 mode, see src/mcp23018.h
+#define MCP_IODIRA 0x00
+#define MCP_IODIRB 0x01
+#define MCP_IOCONA 0x0A
+#define MCP_IOCONB 0x0B
+#define MCP_GPIOA  0x12
+#define MCP_GPIOB  0x13
+#define MCP_OLATA  0x14
+#define MCP_OLATB  0x15
+#define MCP_REGS   0x16
+#define MCP_SEQOP  0x20
+
+typedef struct {
+    uint8_t addr;           ///< 8 bit write address
+    uint8_t reg[MCP_REGS];
+    uint8_t ptr;            ///< register address pointer
+} mcp23018_t;
+
+static mcp23018_t expander[2] = {
+    { .addr = 0x46, .reg = { [MCP_IODIRA] = 0xFF, [MCP_IODIRB] = 0xFF } },
+    { .addr = 0x4E, .reg = { [MCP_IODIRA] = 0xFF, [MCP_IODIRB] = 0xFF } },
+};
+
+static mcp23018_t *dev;     ///< addressed slave, NULL if none
+static bool in_xfer;        ///< between start and stop condition
+static bool sla;            ///< next byte is the slave address
+static bool reading;
+static bool set_ptr;        ///< next byte written is the register address
+
+
+/// Column inputs on GPB: low where a key connects to a GPA pin driven low.
+static uint8_t mcp_gpiob(const mcp23018_t *d)
+{
+    uint8_t half = d - expander, low = 0;
+
+    for(uint8_t pin=0; pin<4; ++pin)
+        if( !((d->reg[MCP_IODIRA] | d->reg[MCP_OLATA]) & (1<<pin)) )
+            low |= host_matrix[half ? 7-pin : 3-pin];
+
+    return (d->reg[MCP_IODIRB] & ~low) | (~d->reg[MCP_IODIRB] & d->reg[MCP_OLATB]);
+}
+
+static void mcp_next(mcp23018_t *d)
+{
+    if( !(d->reg[MCP_IOCONA] & MCP_SEQOP) )
+        d->ptr = (d->ptr + 1) % MCP_REGS;
+}
+
+static uint8_t mcp_read(mcp23018_t *d)
+{
+    uint8_t value = d->reg[d->ptr];
+
+    if(d->ptr == MCP_GPIOB) {
+        value = mcp_gpiob(d);
+        ++host_i2c.row_reads;
+    }
+    mcp_next(d);
+    return value;
+}
+
+static void mcp_write(mcp23018_t *d, uint8_t value)
+{
+    uint8_t reg = d->ptr;
+
+    if(reg == MCP_GPIOA || reg == MCP_GPIOB)
+        reg += MCP_OLATA - MCP_GPIOA;
+    if(reg == MCP_IOCONA || reg == MCP_IOCONB)
+        d->reg[MCP_IOCONA] = d->reg[MCP_IOCONB] = value;
+    d->reg[reg] = value;
+    mcp_next(d);
+}
+
+static mcp23018_t *mcp_find(uint8_t addr)
+{
+    for(uint8_t i=0; i<2; ++i)
+        if(expander[i].addr == addr && !host_i2c.absent[i])
+            return &expander[i];
+    return NULL;
+}
+
+
+/// SCL period [us] from the bit rate register, prescaler 1.
+static double bit_us(void)
+{
+    return (16 + 2*TWBR) * 1e6 / F_CPU;
+}
+
+static bool pending(void)
+{
+    return (twcr & ((1<<TWEN)|(1<<TWINT)|TWCR_DONE)) == ((1<<TWEN)|(1<<TWINT)) && !host_i2c.stuck;
+}
+
+/// Carry out the command in twcr, returns its duration in SCL periods.
+static uint8_t twi_execute(void)
+{
+    uint8_t cmd = twcr, bits = 9;
+
+    if(cmd & (1<<TWSTO)) {
+        in_xfer = false;
+        dev     = NULL;
+        ++host_i2c.transfers;
+        twcr = (cmd & ~((1<<TWINT)|(1<<TWSTO))) | TWCR_DONE;
+        return 1;
+    }
+
+    if(cmd & (1<<TWSTA)) {
+        TWSR    = in_xfer ? TW_REP_START : TW_START;
+        in_xfer = true;
+        sla     = true;
+        dev     = NULL;
+        ++host_i2c.starts;
+        bits    = 1;
+    } else if(sla) {
+        sla     = false;
+        reading = TWDR & TW_READ;
+        set_ptr = !reading;
+        dev     = mcp_find(TWDR & ~TW_READ);
+        if(reading)
+            TWSR = dev ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+        else
+            TWSR = dev ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+        ++host_i2c.bytes;
+    } else if(reading) {
+        TWDR = dev ? mcp_read(dev) : 0xFF;
+        TWSR = (cmd & (1<<TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+        ++host_i2c.bytes;
+    } else {
+        if(dev && set_ptr)
+            dev->ptr = TWDR;
+        else if(dev)
+            mcp_write(dev, TWDR);
+        set_ptr = false;
+        TWSR = dev ? TW_MT_DATA_ACK : TW_MT_DATA_NACK;
+        ++host_i2c.bytes;
+    }
+    twcr = cmd | (1<<TWINT) | TWCR_DONE;
+    return bits;
+}
+
+volatile uint8_t *host_twcr(void)
+{
+    if(host_i2c.stuck)
+        PIND &= ~(1<<1);
+    else
+        PIND |=  (1<<1);
+
+    if( !(twcr & (1<<TWEN)) ) {
+        in_xfer = false;    // TWI disabled: bus released, any slave clocked out
+        dev     = NULL;
+        host_i2c.stuck = false;
+    } else if( pending() && !(twcr & (1<<TWIE)) ) {
+        double us = twi_execute() * bit_us();
+        host_i2c.bus_us += us;
+        _delay_us(us);
+    }
+    return &twcr;
+}
+
+void host_i2c_run(double us)
+{
+    static double credit;
+
+    if( !pending() ) {
+        credit = 0;
+        return;
+    }
+    credit += us;
+    while( pending() && credit > 0 ) {
+        double t = twi_execute() * bit_us();
+        credit -= t;
+        host_i2c.bus_us += t;
+#ifdef HAS_I2C
+        if( (twcr & ((1<<TWIE)|(1<<TWINT))) == ((1<<TWIE)|(1<<TWINT)) )
+            TWI_vect();
+#endif
+    }
+}
+
+bool host_i2c_idle(void)
+{
+    return !pending() && !in_xfer;
+}
@@ -0,0 +1,26 @@
+/*
+ * Host build mock of the LUFA parts used by the key pipeline.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#define ARCH_AVR8 0
+#define ARCH      ARCH_AVR8
+
+#define CONCAT(x, y)            x ## y
+#define CONCAT_EXPANDED(x, y)   CONCAT(x, y)
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+#define ATTR_WARN_UNUSED_RESULT
+#define ATTR_NON_NULL_PTR_ARG(...)
+#define ATTR_PACKED __attribute__ ((packed))
+
+#define GlobalInterruptEnable()  ((void)0)
+#define GlobalInterruptDisable() ((void)0)
@@ -0,0 +1,7 @@
+#pragma once
+#define LEDS_LED1 1
+#define LEDS_LED2 2
+#define LEDS_LED3 4
+#define LEDS_LED4 8
+#define LEDs_Init()        ((void)0)
+#define LEDs_SetAllLEDs(x) ((void)0)
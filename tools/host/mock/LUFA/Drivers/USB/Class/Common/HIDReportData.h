@@ -0,0 +1,31 @@
+/*
+ * Host build mock: HID report descriptor items encoded as by LUFA, so that the
+ * descriptors in src/Descriptors.h can be decoded by the checks.
+ */
+#pragma once
+
+#define HID_IOF_DATA                0x00
+#define HID_IOF_CONSTANT            0x01
+#define HID_IOF_ARRAY               0x00
+#define HID_IOF_VARIABLE            0x02
+#define HID_IOF_ABSOLUTE            0x00
+#define HID_IOF_RELATIVE            0x04
+
+#define HID_RI_ITEM_0(tag, ...)     (tag)
+#define HID_RI_ITEM_8(tag, data)    ((tag) | 1), ((data) & 0xFF)
+#define HID_RI_ITEM_16(tag, data)   ((tag) | 2), ((data) & 0xFF), (((data) >> 8) & 0xFF)
+
+#define HID_RI_INPUT(bits, ...)             HID_RI_ITEM_##bits(0x80, ##__VA_ARGS__)
+#define HID_RI_OUTPUT(bits, ...)            HID_RI_ITEM_##bits(0x90, ##__VA_ARGS__)
+#define HID_RI_COLLECTION(bits, ...)        HID_RI_ITEM_##bits(0xA0, ##__VA_ARGS__)
+#define HID_RI_FEATURE(bits, ...)           HID_RI_ITEM_##bits(0xB0, ##__VA_ARGS__)
+#define HID_RI_END_COLLECTION(bits, ...)    HID_RI_ITEM_##bits(0xC0, ##__VA_ARGS__)
+#define HID_RI_USAGE_PAGE(bits, ...)        HID_RI_ITEM_##bits(0x04, ##__VA_ARGS__)
+#define HID_RI_LOGICAL_MINIMUM(bits, ...)   HID_RI_ITEM_##bits(0x14, ##__VA_ARGS__)
+#define HID_RI_LOGICAL_MAXIMUM(bits, ...)   HID_RI_ITEM_##bits(0x24, ##__VA_ARGS__)
+#define HID_RI_REPORT_SIZE(bits, ...)       HID_RI_ITEM_##bits(0x74, ##__VA_ARGS__)
+#define HID_RI_REPORT_ID(bits, ...)         HID_RI_ITEM_##bits(0x84, ##__VA_ARGS__)
+#define HID_RI_REPORT_COUNT(bits, ...)      HID_RI_ITEM_##bits(0x94, ##__VA_ARGS__)
+#define HID_RI_USAGE(bits, ...)             HID_RI_ITEM_##bits(0x08, ##__VA_ARGS__)
+#define HID_RI_USAGE_MINIMUM(bits, ...)     HID_RI_ITEM_##bits(0x18, ##__VA_ARGS__)
+#define HID_RI_USAGE_MAXIMUM(bits, ...)     HID_RI_ITEM_##bits(0x28, ##__VA_ARGS__)
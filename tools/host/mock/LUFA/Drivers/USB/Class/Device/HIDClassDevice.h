@@ -0,0 +1,30 @@
+#pragma once
+#include <LUFA/Common/Common.h>
+#include <LUFA/Drivers/USB/Class/Common/HIDReportData.h>
+
+typedef struct {
+    uint8_t Modifier;
+    uint8_t Reserved;
+    uint8_t KeyCode[6];
+} ATTR_PACKED USB_KeyboardReport_Data_t;
+
+typedef struct {
+    uint8_t  Address;
+    uint16_t Size;
+    uint8_t  Banks;
+} USB_Endpoint_Table_t;
+
+typedef struct {
+    struct {
+        uint8_t InterfaceNumber;
+        USB_Endpoint_Table_t ReportINEndpoint;
+        void*   PrevReportINBuffer;
+        uint8_t PrevReportINBufferSize;
+    } Config;
+    struct {
+        bool     UsingReportProtocol;
+        uint16_t PrevFrameNum;
+        uint16_t IdleCount;
+        uint16_t IdleMSRemaining;
+    } State;
+} USB_ClassInfo_HID_Device_t;
@@ -0,0 +1,45 @@
+/*
+ * Host build mock: descriptor types and constants, so that Descriptors.h compiles.
+ * No USB stack is simulated, reports are fetched directly by the replay driver.
+ */
+#pragma once
+#include <LUFA/Common/Common.h>
+
+typedef uint8_t USB_Descriptor_HIDReport_Datatype_t;
+
+typedef struct { uint8_t Size, Type; } USB_Descriptor_Header_t;
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint16_t TotalConfigurationSize;
+    uint8_t  TotalInterfaces, ConfigurationNumber, ConfigurationStrIndex, ConfigAttributes, MaxPowerConsumption;
+} USB_Descriptor_Configuration_Header_t;
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint8_t InterfaceNumber, AlternateSetting, TotalEndpoints, Class, SubClass, Protocol, InterfaceStrIndex;
+} USB_Descriptor_Interface_t;
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint16_t HIDSpec;
+    uint8_t  CountryCode, TotalReportDescriptors, HIDReportType;
+    uint16_t HIDReportLength;
+} USB_HID_Descriptor_HID_t;
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint8_t  EndpointAddress, Attributes;
+    uint16_t EndpointSize;
+    uint8_t  PollingIntervalMS;
+} USB_Descriptor_Endpoint_t;
+typedef struct {
+    uint8_t Button;
+    int8_t  X, Y;
+} USB_MouseReport_Data_t;
+
+#define ENDPOINT_DIR_IN 0x80
+
+enum { DEVICE_STATE_Unattached, DEVICE_STATE_Powered, DEVICE_STATE_Default,
+       DEVICE_STATE_Addressed, DEVICE_STATE_Configured, DEVICE_STATE_Suspended };
+extern volatile uint8_t USB_DeviceState;
+
+static inline void USB_Init(void) {}
+
+#include <LUFA/Drivers/USB/Class/Device/HIDClassDevice.h>
@@ -0,0 +1,5 @@
+/*
+ * Host build fallback if src/_private_data.h was not yet created by make.
+ */
+#pragma once
+#include "src/_private_data_template.h"
@@ -0,0 +1,20 @@
+/*
+ * Host build mock: EEPROM addresses are offsets into a RAM image in tools/host/host.c
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+#define EEMEM
+
+uint8_t  eeprom_read_byte  (const uint8_t *p);
+uint16_t eeprom_read_word  (const uint16_t *p);
+void     eeprom_read_block (void *dst, const void *src, size_t n);
+void     eeprom_write_byte (uint8_t *p, uint8_t value);
+void     eeprom_update_byte(uint8_t *p, uint8_t value);
+void     eeprom_update_word(uint16_t *p, uint16_t value);
+void     eeprom_update_block(const void *src, void *dst, size_t n);
+
+#define eeprom_busy_wait() ((void)0)
+#define eeprom_is_ready()  1
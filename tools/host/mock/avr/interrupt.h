@@ -0,0 +1,9 @@
+/*
+ * Host build mock: ISRs become plain functions, called by the replay driver.
+ */
+#pragma once
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define cli() ((void)0)
+#define sei() ((void)0)
@@ -0,0 +1,66 @@
+/*
+ * Host build mock: AVR registers are plain variables defined in tools/host/host.c,
+ * bit numbers are only needed to compile the setup code.
+ */
+#pragma once
+#include <stdint.h>
+
+#define __AVR_ATmega32U4__ 1
+#define _BV(b) (1<<(b))
+
+#define HOST_SFR8(n) extern volatile uint8_t n;
+HOST_SFR8(PINB) HOST_SFR8(PINC) HOST_SFR8(PIND) HOST_SFR8(PINE) HOST_SFR8(PINF)
+HOST_SFR8(DDRB) HOST_SFR8(DDRC) HOST_SFR8(DDRD) HOST_SFR8(DDRE) HOST_SFR8(DDRF)
+HOST_SFR8(PORTB) HOST_SFR8(PORTC) HOST_SFR8(PORTD) HOST_SFR8(PORTE) HOST_SFR8(PORTF)
+HOST_SFR8(TCCR0A) HOST_SFR8(TCCR0B) HOST_SFR8(TIMSK0) HOST_SFR8(OCR0A)
+HOST_SFR8(TCCR1A) HOST_SFR8(TCCR1B) HOST_SFR8(TCCR3A) HOST_SFR8(TCCR3B) HOST_SFR8(TIMSK3)
+HOST_SFR8(TCCR4A) HOST_SFR8(TCCR4B) HOST_SFR8(TCCR4C) HOST_SFR8(OCR4D)
+HOST_SFR8(MCUSR) HOST_SFR8(SREG)
+
+extern volatile uint16_t OCR1A, OCR1B, OCR1C, ICR1, OCR3A;
+
+/// Timer3 count from the simulated clock, each read takes one count.
+uint16_t host_tcnt3(void);
+#define TCNT3 (host_tcnt3())
+
+#define WGM01  1
+#define CS00   0
+#define CS01   1
+#define OCIE0A 1
+#define WGM11  1
+#define WGM13  4
+#define CS10   0
+#define COM1A1 7
+#define COM1B1 5
+#define COM1C1 3
+#define WGM32  3
+#define CS30   0
+#define CS31   1
+#define OCIE3A 1
+#define COM4A1 7
+#define COM4B1 5
+#define COM4D1 3
+#define PWM4A  1
+#define PWM4B  0
+#define PWM4D  0
+#define CS40   0
+#define CS43   3
+#define WDRF   3
+
+/*
+ * TWI: every access to TWCR lets tools/host/i2c.c carry out a command written before,
+ * so the busy waits of blocking code complete.
+ */
+HOST_SFR8(TWSR) HOST_SFR8(TWDR) HOST_SFR8(TWBR)
+volatile uint8_t *host_twcr(void);
+#define TWCR (*host_twcr())
+
+#define TWINT  7
+#define TWEA   6
+#define TWSTA  5
+#define TWSTO  4
+#define TWWC   3
+#define TWEN   2
+#define TWIE   0
+
+#define E2END 0x3FF
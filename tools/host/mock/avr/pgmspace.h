@@ -0,0 +1,24 @@
+/*
+ * Host build mock: flash is ordinary memory, host_flash_reads counts accesses.
+ * memcpy_P() leaves its source in host_flash_last and applies the patches set by
+ * host_flash_patch(), so checks can change keymap entries as they are read.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+extern uint32_t    host_flash_reads;
+extern const void *host_flash_last;
+
+void *host_memcpy_P(void *dst, const void *src, size_t n);
+void  host_flash_patch(const void *addr, const void *data, size_t n);
+void  host_flash_unpatch(void);
+
+#define pgm_read_byte(p) (++host_flash_reads, *(const uint8_t*)(p))
+#define pgm_read_word(p) (++host_flash_reads, *(const uint16_t*)(p))
+#define memcpy_P(d,s,n)  host_memcpy_P((d),(s),(n))
+#define strlen_P  strlen
+#define strcpy_P  strcpy
+#define strncpy_P strncpy
@@ -0,0 +1,3 @@
+#pragma once
+#define clock_prescale_set(x) ((void)0)
+#define clock_div_1 0
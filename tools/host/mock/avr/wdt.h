@@ -0,0 +1,4 @@
+#pragma once
+#define wdt_disable() ((void)0)
+#define wdt_enable(t) ((void)0)
+#define WDTO_15MS 0
@@ -0,0 +1,12 @@
+/*
+ * Host build mock: single threaded, ISRs are called between main loop steps.
+ * Blocks are only tracked, so tools/host/host.c can account busy waits in them.
+ */
+#pragma once
+
+void host_atomic_enter(void);
+void host_atomic_leave(void);
+
+#define ATOMIC_BLOCK(type) for(int __atomic_once=(host_atomic_enter(),1); __atomic_once; __atomic_once=(host_atomic_leave(),0))
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON      0
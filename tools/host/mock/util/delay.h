@@ -0,0 +1,7 @@
+/*
+ * Host build mock: delays advance the simulated clock, see tools/host/host.c
+ */
+#pragma once
+
+void _delay_us(double us);
+void _delay_ms(double ms);
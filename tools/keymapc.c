@@ -0,0 +1,146 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/keymap.h"
+
+
+/* DOCUMENTATION
+
+Keymap compiler: reads KeyMatrix[][][] of src/keymap.h as compiled natively for
+one board and writes the packed representation used by getKeyStruct() with
+KEYMAP_PACKED, see keymap_row_t in keymap.h:
+
+  - layer 0 is kept dense, it is looked up for every key press
+  - each row of the higher layers is a bitmask of its defined keys (not _no)
+    and the index of its first key in a list of all defined keys
+  - rows with the same keys share their entries, e.g. repeated thumb rows
+
+The sizes of both representations are printed to stderr.
+
+Built and run by the makefile for KB_PACKED=1 with the board defines:
+
+    gcc -DHOST -DBLACKBOWL -Itools/host/mock -I. -Isrc tools/keymapc.c -o keymapc
+    ./keymapc > keymap_packed.h
+*/
+
+
+#if LAYERS < 2
+    #error "Nothing to pack with a single layer"
+#endif
+
+#define ENTRIES_MAX (256+COLS)  // base index of a row must fit into 8 bit
+
+static keycode      g_entries[ENTRIES_MAX];
+static unsigned     g_count;
+static keymap_row_t g_rows[LAYERS-1][ROWS];
+
+static bool is_no(keycode kc)
+{
+    return kc.hid == 0 && kc.mods == 0;
+}
+
+/// Index of an existing run of the same n keys, or else of the keys appended.
+static unsigned add_entries(const keycode *keys, unsigned n)
+{
+    for(unsigned i=0; i+n <= g_count; ++i) {
+        if(memcmp(&g_entries[i], keys, n*sizeof(keycode)) == 0)
+            return i;
+    }
+    if(g_count+n > ENTRIES_MAX) {
+        fprintf(stderr, "keymapc: too many keys in higher layers\n");
+        exit(1);
+    }
+    memcpy(&g_entries[g_count], keys, n*sizeof(keycode));
+    g_count += n;
+    return g_count-n;
+}
+
+static void print_keycode(keycode kc)
+{
+    printf("{0x%02X,0x%02X}", kc.hid, kc.mods);
+}
+
+int main(void)
+{
+    for(uint8_t layer=1; layer<LAYERS; ++layer) {
+        for(uint8_t row=0; row<ROWS; ++row) {
+            keycode keys[COLS];
+            unsigned n=0;
+            column_size_t mask=0;
+
+            for(uint8_t col=0; col<COLS; ++col) {
+                keycode kc = KeyMatrix[layer][row][col];
+                if(is_no(kc))
+                    continue;
+                mask |= (column_size_t)1<<col;
+                keys[n++] = kc;
+            }
+            unsigned base = n ? add_entries(keys, n) : 0;
+            if(base > 255) {
+                fprintf(stderr, "keymapc: too many keys in higher layers\n");
+                return 1;
+            }
+            g_rows[layer-1][row] = (keymap_row_t) { .base=base, .mask=mask };
+        }
+    }
+
+    printf("/* Generated by tools/keymapc.c from src/keymap.h for %s - do not edit. */\n\n", KEYMAP_BOARD);
+    printf("#ifndef %s\n    #error \"keymap_packed.h was generated for %s\"\n#endif\n\n", KEYMAP_BOARD, KEYMAP_BOARD);
+
+    printf("static const keycode KeyLayer0[ROWS][COLS] PROGMEM = {\n");
+    for(uint8_t row=0; row<ROWS; ++row) {
+        printf("    {");
+        for(uint8_t col=0; col<COLS; ++col) {
+            printf(col ? "," : "");
+            print_keycode(KeyMatrix[0][row][col]);
+        }
+        printf("},\n");
+    }
+    printf("};\n\n");
+
+    printf("static const keymap_row_t KeyRows[LAYERS-1][ROWS] PROGMEM = {\n");
+    for(uint8_t layer=1; layer<LAYERS; ++layer) {
+        printf("    {");
+        for(uint8_t row=0; row<ROWS; ++row)
+            printf("%s{%u,0x%X}", row ? "," : "", g_rows[layer-1][row].base, (unsigned)g_rows[layer-1][row].mask);
+        printf("},\n");
+    }
+    printf("};\n\n");
+
+    printf("static const keycode KeyEntries[%u] PROGMEM = {", g_count ? g_count : 1);
+    for(unsigned i=0; i<g_count; ++i) {
+        printf(i%8 ? "," : (i ? ",\n    " : "\n    "));
+        print_keycode(g_entries[i]);
+    }
+    printf("%s\n};\n", g_count ? "" : "\n    {0,0}");
+
+    unsigned dense  = sizeof(KeyMatrix);
+    unsigned packed = ROWS*COLS*sizeof(keycode) + (LAYERS-1)*ROWS*(1+sizeof(column_size_t))
+                    + g_count*sizeof(keycode);
+    fprintf(stderr, "*** keymap %s: %u layers dense %u bytes, packed %u bytes (%u keys in higher layers)\n",
+            KEYMAP_BOARD, LAYERS, dense, packed, g_count);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/avr_mcu_section.h>
+
+#include "src/matrix.h"
+
+
+/* DOCUMENTATION
+
+CPU cycles of scan_matrix() on a direct wired board, built with avr-gcc and run
+on simavr by make scan-cycles, for each debounce engine with and without
+pipelining.
+
+Timer1 runs at the CPU clock and is read before and after each scan. Interrupts
+stay off: the scan timer only counts for the settle waits, and the millisecond
+timer stands still. The undriven input pins decide which keys seem pressed, so
+the first scans may debounce changes. Minimum, average and maximum of all scans
+are written to the simavr console register, the program then sleeps with
+interrupts off, which ends the simulation.
+*/
+
+
+AVR_MCU(F_CPU, "atmega32u4");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+#define SCANS 64
+
+static void put(const char *s)
+{
+    while(*s)
+        GPIOR0 = *s++;
+}
+
+static void put_u(uint32_t v)
+{
+    char buf[11], *p = buf + sizeof(buf) - 1;
+
+    *p = 0;
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    put(p);
+}
+
+int main(void)
+{
+    uint16_t min = 0xFFFF, max = 0;
+    uint32_t sum = 0;
+
+    init_cols();
+    init_scan_timer();
+    TCCR1A = 0;
+    TCCR1B = (1<<CS10);
+
+    for(uint8_t i=0; i<SCANS; ++i) {
+        uint16_t start = TCNT1;
+        scan_matrix();
+        uint16_t cycles = TCNT1 - start;
+
+        sum += cycles;
+        if(cycles < min)
+            min = cycles;
+        if(cycles > max)
+            max = cycles;
+    }
+
+    put("cycles per scan: min ");
+    put_u(min);
+    put(" avg ");
+    put_u(sum / SCANS);
+    put(" max ");
+    put_u(max);
+    put(", ");
+    put_u(min / (F_CPU/1000000));
+    put(" us\n");
+
+    cli();
+    sleep_mode();
+    return 0;
+}
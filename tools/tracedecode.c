@@ -0,0 +1,122 @@
+/*
+    This file is part of the AdNW keyboard firmware.
+
+    Copyright 2020 Stefan Fröbe, <frobiac /at/ gmail [d0t] com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+/* DOCUMENTATION
+
+Decoder for key event traces recorded with KB_TRACE=1 (see src/trace.h)
+and dumped with command mode key T to the debug console (hid_listen).
+
+Input  : console output containing the dump, read from stdin.
+         Each record is "tttt:yydd" in hex: time [ms], type and data.
+Output : readable timeline with times relative to the first record,
+         or with -r just the key presses and releases as replay input:
+
+             <time [ms]> +<key id>
+             <time [ms]> -<key id>
+
+         Key ids are row<<4|col in hex, as used by keyIdChange().
+*/
+
+enum trace_type {
+    TRACE_RELEASE = 0,
+    TRACE_PRESS,
+    TRACE_HOLD,
+    TRACE_DUAL_HOLD,
+    TRACE_DUAL_TAP,
+    TRACE_REPORT,
+    TRACE_REPORT_KEY,
+    TRACE_COMBO,
+};
+
+bool     g_replay = false;
+bool     g_first  = true;
+uint16_t g_last;    // raw time of previous record
+uint32_t g_time;    // ms since first record, 16 bit timer wraps every 65s
+bool     g_report;  // report line still open for its keys
+
+void record(uint16_t time, uint8_t type, uint8_t data)
+{
+    if(g_first) {
+        g_first = false;
+        g_last  = time;
+    }
+    g_time += (uint16_t)(time - g_last);
+    g_last  = time;
+
+    if(g_replay) {
+        if(type == TRACE_PRESS || type == TRACE_RELEASE)
+            printf("%u %c%02X\n", g_time, type == TRACE_PRESS ? '+' : '-', data);
+        return;
+    }
+
+    if(type == TRACE_REPORT_KEY) {
+        printf(" %02X", data);
+        return;
+    }
+    if(g_report)
+        printf("\n");
+    g_report = false;
+
+    printf("%8u  ", g_time);
+    switch(type) {
+        case TRACE_RELEASE:   printf("-%02X  release", data); break;
+        case TRACE_PRESS:     printf("+%02X  press", data); break;
+        case TRACE_HOLD:      printf(" %02X  hold", data); break;
+        case TRACE_DUAL_HOLD: printf(" %02X  dual use -> hold", data); break;
+        case TRACE_DUAL_TAP:  printf(" %02X  dual use -> tap", data); break;
+        case TRACE_COMBO:     printf(" %02X  combo", data); break;
+        case TRACE_REPORT:
+            printf("     report mod=%02X keys:", data);
+            g_report = true;
+            return;
+        default:              printf(" %02X  unknown type %02X", data, type); break;
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    char line[256];
+
+    if(argc > 1 && strcmp(argv[1], "-r") == 0)
+        g_replay = true;
+
+    while(fgets(line, sizeof(line), stdin)) {
+        if(strncmp(line, "TR ", 3) != 0)
+            continue;
+
+        unsigned int time, type, data;
+        int n;
+        for(char *p = line+2; sscanf(p, " %4x:%2x%2x%n", &time, &type, &data, &n) == 3; p += n)
+            record(time, type, data);
+    }
+    if(g_report)
+        printf("\n");
+    return 0;
+}
+
+
+// gcc -Werror --std=c11 tracedecode.c -o tracedecode && hid_listen | ./tracedecode [-r]